@@ -1,21 +1,197 @@
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
 #include "block.h"
+#include "pagemap.h"
+#include "slab.h"
+#include "stats.h"
+#include "tunables.h"
+
+// Each thread allocates from the arena set of its CPU, and moves to a
+// sibling set when its own is locked by someone else
+static arena_set_t arena_sets[MAX_ARENA_SETS];
+static size_t arena_sets_count;
+static size_t next_arena_set;  // round robin when the CPU is unknown
+static pthread_once_t arena_sets_once = PTHREAD_ONCE_INIT;
+static THREAD_LOCAL arena_set_t *thread_arena_set;
+
+// Huge blocks belong to no arena, their counters are updated atomically
+static struct malloc_arena_stats huge_stats;
 
-arena_t small_arena = { .block_size = SMALL_BLOCK, .blocks = { NULL } };
-arena_t medium_arena = { .block_size = MEDIUM_BLOCK, .blocks = { NULL } };
-arena_t large_arena = { .block_size = LARGE_BLOCK, .blocks = { NULL } };
+static void
+init_arena_sets(void)
+{
+	load_tunables();  // arenas take the sizes of their blocks from it
+
+	long count = ARENA_SETS;
+	if (count <= 0)
+		count = ARENAS_PER_CPU * sysconf(_SC_NPROCESSORS_ONLN);
+	if (count <= 0)
+		count = 1;
+	if (count > MAX_ARENA_SETS)
+		count = MAX_ARENA_SETS;
+
+	for (long i = 0; i < count; i++) {
+		pthread_mutex_init(&arena_sets[i].lock, NULL);
+		for (int kind = 0; kind < ARENA_KINDS; kind++) {
+			arena_t *arena = &arena_sets[i].arenas[kind];
+			arena->id = i * ARENA_KINDS + kind;
+			arena->block_size = tunables.block_sizes[kind];
+		}
+	}
+	arena_sets_count = count;
+}
+
+// returns the arena set the calling thread is bound to
+static arena_set_t *
+current_arena_set(void)
+{
+	if (!thread_arena_set) {
+		pthread_once(&arena_sets_once, init_arena_sets);
+
+		int cpu = sched_getcpu();
+		size_t index = cpu >= 0 ? (size_t) cpu
+		                        : __atomic_fetch_add(&next_arena_set,
+		                                             1,
+		                                             __ATOMIC_RELAXED);
+		thread_arena_set = &arena_sets[index % arena_sets_count];
+	}
+	return thread_arena_set;
+}
 
+/// Remote frees ///
+
+// Memory freed by a thread bound to another arena set doesn't take the
+// lock of its set: it's pushed to a lock-free stack of the set, linked
+// through its first bytes. Whoever locks the set next (usually a thread
+// of the set, to allocate) frees it all at once.
+
+// returns true if the set isn't the one the calling thread is bound to
+bool
+is_remote_set(arena_set_t *set)
+{
+	return set != thread_arena_set;
+}
+
+// pushes memory of the set freed by another thread, with a single
+// compare and swap. Regions are marked as cached until they are
+// released, so double frees are still detected.
+void
+push_remote_free(arena_set_t *set, void *ptr)
+{
+	void *head = __atomic_load_n(&set->remote_frees, __ATOMIC_RELAXED);
+	do {
+		*(void **) ptr = head;
+	} while (!__atomic_compare_exchange_n(&set->remote_frees,
+	                                      &head,
+	                                      ptr,
+	                                      true,
+	                                      __ATOMIC_RELEASE,
+	                                      __ATOMIC_RELAXED));
+}
+
+// frees the memory other threads pushed to the set, which the caller
+// has just locked, and returns the set
+static arena_set_t *
+drain_remote_frees(arena_set_t *set)
+{
+	if (!__atomic_load_n(&set->remote_frees, __ATOMIC_RELAXED))
+		return set;
+
+	void *ptr = __atomic_exchange_n(&set->remote_frees, NULL, __ATOMIC_ACQUIRE);
+	while (ptr) {
+		void *next = *(void **) ptr;
+		struct block *block = get_block(ptr);
+
+		if (block->kind == SLAB_BLOCK) {
+			slab_free(block->memory, ptr);
+		} else {
+			struct region *region = PTR2REGION(ptr);
+			region->cached = false;
+			release_region(region);
+		}
+		ptr = next;
+	}
+	return set;
+}
+
+// locks the arena set of the thread, or the first sibling that is
+// not busy, which becomes the set of the thread
+arena_set_t *
+lock_arena_set(void)
+{
+	arena_set_t *set = current_arena_set();
+	if (pthread_mutex_trylock(&set->lock) == 0)
+		return drain_remote_frees(set);
+
+	size_t index = set - arena_sets;
+	for (size_t i = 1; i < arena_sets_count; i++) {
+		arena_set_t *sibling =
+		        &arena_sets[(index + i) % arena_sets_count];
+		if (pthread_mutex_trylock(&sibling->lock) == 0) {
+			thread_arena_set = sibling;
+			return drain_remote_frees(sibling);
+		}
+	}
+
+	pthread_mutex_lock(&set->lock);
+	return drain_remote_frees(set);
+}
+
+arena_set_t *
+get_arena_set(arena_t *arena)
+{
+	return &arena_sets[arena->id / ARENA_KINDS];
+}
+
+// locks the arena set that owns the arena
+arena_set_t *
+lock_arena_set_of(arena_t *arena)
+{
+	arena_set_t *set = get_arena_set(arena);
+	pthread_mutex_lock(&set->lock);
+	return drain_remote_frees(set);
+}
+
+// locks the arena set that owns the region
+arena_set_t *
+lock_region_arena_set(struct region *region)
+{
+	return lock_arena_set_of(get_region_arena(region));
+}
+
+void
+unlock_arena_set(arena_set_t *set)
+{
+	pthread_mutex_unlock(&set->lock);
+}
+
+arena_set_t *
+get_region_arena_set(struct region *region)
+{
+	return &arena_sets[region->arena / ARENA_KINDS];
+}
+
+// returns the arena of the thread's set for the size
 arena_t *
 get_arena(size_t size)
 {
-	arena_t *arena = NULL;
-	if (size + REGION_HEADER_SIZE <= SMALL_BLOCK) {
-		arena = &small_arena;
-	} else if (size + REGION_HEADER_SIZE <= MEDIUM_BLOCK) {
-		arena = &medium_arena;
-	} else if (size + REGION_HEADER_SIZE <= LARGE_BLOCK) {
-		arena = &large_arena;
+	for (int kind = 0; kind < ARENA_KINDS; kind++) {
+		if (size + REGION_HEADER_SIZE <= tunables.block_sizes[kind])
+			return &current_arena_set()->arenas[kind];
 	}
-	return arena;
+	return NULL;
+}
+
+arena_t *
+get_region_arena(struct region *region)
+{
+	arena_set_t *set = get_region_arena_set(region);
+	return &set->arenas[region->arena % ARENA_KINDS];
 }
 
 // finds the next free region
@@ -23,111 +199,957 @@ get_arena(size_t size)
 struct region *
 find_free_region(size_t size)
 {
+	arena_set_t *set = current_arena_set();
 	struct region *free_region = NULL;
-	if (size + REGION_HEADER_SIZE <= SMALL_BLOCK) {
-		free_region = search_strategy(size, small_arena.blocks);
+
+	for (int kind = 0; kind < ARENA_KINDS && !free_region; kind++) {
+		if (size + REGION_HEADER_SIZE <= tunables.block_sizes[kind])
+			free_region = search_strategy(size, &set->arenas[kind]);
 	}
-	if (!free_region && size + REGION_HEADER_SIZE <= MEDIUM_BLOCK) {
-		free_region = search_strategy(size, medium_arena.blocks);
+	return free_region;
+}
+
+/// Size class bins ///
+
+// returns the bin of the regions of the given size
+size_t
+size_class(size_t size)
+{
+	if (size < (1UL << BIN_MIN_SHIFT))
+		return 0;
+
+	size_t shift = BINMAP_BITS - 1 - __builtin_clzl(size);
+	size_t step = (size >> (shift - BIN_STEPS_SHIFT)) &
+	              ((1UL << BIN_STEPS_SHIFT) - 1);
+	size_t bin = 1 + ((shift - BIN_MIN_SHIFT) << BIN_STEPS_SHIFT) + step;
+
+	return bin < BIN_COUNT ? bin : BIN_COUNT - 1;
+}
+
+// returns the first bin from the given one that has free regions,
+// or BIN_COUNT if there is none
+static size_t
+next_used_bin(arena_t *arena, size_t bin)
+{
+	for (size_t word = bin / BINMAP_BITS; word < BINMAP_WORDS; word++) {
+		unsigned long bits = arena->binmap[word];
+		if (word == bin / BINMAP_BITS)
+			bits &= ~0UL << (bin % BINMAP_BITS);
+		if (bits)
+			return word * BINMAP_BITS + __builtin_ctzl(bits);
 	}
-	if (!free_region && size + REGION_HEADER_SIZE <= LARGE_BLOCK) {
-		free_region = search_strategy(size, large_arena.blocks);
+	return BIN_COUNT;
+}
+
+// Strategies and purging walk a bin with a cursor, which doesn't depend
+// on how the bin is stored
+struct bin_cursor {
+	struct region *region;  // NULL after the last one
+	size_t size;
+	uint64_t freed_at;
+#ifdef SIDE_TABLE
+	struct bin_entry *entry;
+	struct bin_entry *entries;
+#endif
+};
+
+// moves the bytes of the region between the allocated and free counts
+// of its arena as it goes in or out of a bin
+static void
+count_bin_region(arena_t *arena, struct region *region, bool in_bin)
+{
+	if (in_bin) {
+		arena->free_regions++;
+		arena->free += region->size;
+		arena->allocated -= region->size;
+	} else {
+		arena->free_regions--;
+		arena->free -= region->size;
+		arena->allocated += region->size;
 	}
-	return free_region;
 }
 
-#ifdef FIRST_FIT
-struct region *
-search_strategy(size_t size, struct region **blocks)
+#ifdef SIDE_TABLE
+// maps the entries of an empty table, or doubles them
+static bool
+grow_bin_table(struct bin_table *table)
 {
-	for (int i = 0; i < MAX_BLOCKS; i++) {
-		struct region *region = blocks[i];
-		while (region != NULL) {
-			if (region->size >= size && region->free) {
-				region->free = false;
-				return region;
-			}
-			region = region->next;
-		}
+	size_t size = table->capacity * sizeof(struct bin_entry);
+	size_t new_size = size ? 2 * size : PAGE_SIZE;
+	void *entries;
+
+	if (size)
+		entries = mremap(table->entries, size, new_size, MREMAP_MAYMOVE);
+	else
+		entries = mmap(NULL,
+		               new_size,
+		               PROT_READ | PROT_WRITE,
+		               MAP_PRIVATE | MAP_ANONYMOUS,
+		               -1,
+		               0);
+	if (entries == MAP_FAILED)
+		return false;
+
+	table->entries = entries;
+	table->capacity = new_size / sizeof(struct bin_entry);
+	return true;
+}
+
+#ifdef ADDRESS_ORDER
+// Address ordered tables are kept by decreasing address, so the cursor
+// (which walks from the last entry) gives the lowest regions first.
+// returns the entry of the region, or the one it has to take.
+static struct bin_entry *
+find_entry(struct bin_table *table, struct region *region)
+{
+	size_t low = 0;
+	size_t high = table->count;
+
+	while (low < high) {
+		size_t middle = (low + high) / 2;
+		if (table->entries[middle].region > region)
+			low = middle + 1;
+		else
+			high = middle;
 	}
-	return NULL;
+	return &table->entries[low];
 }
 #endif
 
-#ifdef BEST_FIT
-struct region *
-search_strategy(size_t size, struct region **blocks)
+void
+bin_insert(struct region *region)
+{
+	if (region->in_bin)
+		return;
+
+	arena_t *arena = get_region_arena(region);
+	size_t bin = size_class(region->size);
+	struct bin_table *table = &arena->bins[bin];
+
+	// If the table can't grow, the region stays out of the bins until
+	// it's coalesced with a neighbour
+	if (table->count == table->capacity && !grow_bin_table(table))
+		return;
+
+#ifdef ADDRESS_ORDER
+	struct bin_entry *entry = find_entry(table, region);
+	memmove(entry + 1,
+	        entry,
+	        (table->entries + table->count - entry) * sizeof(*entry));
+#else
+	struct bin_entry *entry = &table->entries[table->count];
+	REGION2LINKS(region)->entry = table->count;
+#endif
+	table->count++;
+	entry->region = region;
+	entry->size = region->size;
+	entry->freed_at = clock_ms();
+	arena->binmap[bin / BINMAP_BITS] |= 1UL << (bin % BINMAP_BITS);
+	count_bin_region(arena, region, true);
+	region->in_bin = true;
+}
+
+// In LIFO tables the region knows its entry, and the last entry takes
+// its place
+void
+bin_remove(struct region *region)
+{
+	if (!region->in_bin)
+		return;
+
+	arena_t *arena = get_region_arena(region);
+	size_t bin = size_class(region->size);
+	struct bin_table *table = &arena->bins[bin];
+
+#ifdef ADDRESS_ORDER
+	struct bin_entry *entry = find_entry(table, region);
+	table->count--;
+	memmove(entry,
+	        entry + 1,
+	        (table->entries + table->count - entry) * sizeof(*entry));
+#else
+	size_t index = REGION2LINKS(region)->entry;
+	struct bin_entry *last = &table->entries[--table->count];
+	if (index != table->count) {
+		table->entries[index] = *last;
+		REGION2LINKS(last->region)->entry = index;
+	}
+#endif
+
+	if (!table->count)
+		arena->binmap[bin / BINMAP_BITS] &= ~(1UL << (bin % BINMAP_BITS));
+	count_bin_region(arena, region, false);
+	region->in_bin = false;
+}
+
+static void
+read_entry(struct bin_cursor *cursor)
+{
+	if (cursor->entry == cursor->entries) {
+		cursor->region = NULL;
+		return;
+	}
+
+	struct bin_entry *entry = cursor->entry - 1;
+	cursor->region = entry->region;
+	cursor->size = entry->size;
+	cursor->freed_at = entry->freed_at;
+}
+
+// the last entries are walked first: the last freed regions, like in
+// the lists, or the lowest ones if they are address ordered
+static void
+bin_first(arena_t *arena, size_t bin, struct bin_cursor *cursor)
+{
+	struct bin_table *table = &arena->bins[bin];
+
+	cursor->entries = table->entries;
+	cursor->entry = table->entries + table->count;
+	read_entry(cursor);
+}
+
+static void
+bin_next(struct bin_cursor *cursor)
+{
+	cursor->entry--;
+	read_entry(cursor);
+}
+
+// starts the cursor at the rover of the arena if it's in the bin, and
+// returns true, or else at the first entry. Entries move when others
+// are removed, so the rover is only a position in the walk.
+static bool
+bin_resume(arena_t *arena, size_t bin, struct bin_cursor *cursor)
+{
+	struct bin_table *table = &arena->bins[bin];
+
+	if (arena->rover_bin != bin || arena->rover == 0 ||
+	    arena->rover >= table->count) {
+		bin_first(arena, bin, cursor);
+		return false;
+	}
+	cursor->entries = table->entries;
+	cursor->entry = table->entries + arena->rover;
+	read_entry(cursor);
+	return true;
+}
+
+// makes the position of the cursor the rover of the arena
+static void
+bin_save_rover(arena_t *arena, size_t bin, struct bin_cursor *cursor)
+{
+	arena->rover_bin = bin;
+	arena->rover = cursor->entry - cursor->entries;
+}
+#else
+void
+bin_insert(struct region *region)
+{
+	if (region->in_bin)
+		return;
+
+	arena_t *arena = get_region_arena(region);
+	size_t bin = size_class(region->size);
+	struct free_links *links = REGION2LINKS(region);
+	struct region *prev = NULL;
+
+#ifdef ADDRESS_ORDER
+	// The list is kept by increasing address
+	for (struct region *next = arena->bins[bin]; next && next < region;
+	     next = REGION2LINKS(next)->next)
+		prev = next;
+#endif
+	links->prev = prev;
+	links->next = prev ? REGION2LINKS(prev)->next : arena->bins[bin];
+	if (links->next)
+		REGION2LINKS(links->next)->prev = region;
+	if (prev)
+		REGION2LINKS(prev)->next = region;
+	else
+		arena->bins[bin] = region;
+	links->freed_at = clock_ms();
+	arena->binmap[bin / BINMAP_BITS] |= 1UL << (bin % BINMAP_BITS);
+	count_bin_region(arena, region, true);
+	region->in_bin = true;
+}
+
+void
+bin_remove(struct region *region)
+{
+	if (!region->in_bin)
+		return;
+
+	arena_t *arena = get_region_arena(region);
+	size_t bin = size_class(region->size);
+	struct free_links *links = REGION2LINKS(region);
+
+	if (arena->rover == region)
+		arena->rover = links->next;
+	if (links->prev)
+		REGION2LINKS(links->prev)->next = links->next;
+	else
+		arena->bins[bin] = links->next;
+	if (links->next)
+		REGION2LINKS(links->next)->prev = links->prev;
+
+	if (!arena->bins[bin])
+		arena->binmap[bin / BINMAP_BITS] &= ~(1UL << (bin % BINMAP_BITS));
+	count_bin_region(arena, region, false);
+	region->in_bin = false;
+
+}
+
+static void
+read_links(struct bin_cursor *cursor)
+{
+	if (cursor->region) {
+		cursor->size = cursor->region->size;
+		cursor->freed_at = REGION2LINKS(cursor->region)->freed_at;
+	}
+}
+
+static void
+bin_first(arena_t *arena, size_t bin, struct bin_cursor *cursor)
+{
+	cursor->region = arena->bins[bin];
+	read_links(cursor);
+}
+
+static void
+bin_next(struct bin_cursor *cursor)
+{
+	cursor->region = REGION2LINKS(cursor->region)->next;
+	read_links(cursor);
+}
+
+// starts the cursor at the rover of the arena if it's in the bin, and
+// returns true, or else at the first region. bin_remove moves the rover
+// past the region it takes out, so it's always in its bin.
+static bool
+bin_resume(arena_t *arena, size_t bin, struct bin_cursor *cursor)
+{
+	if (arena->rover_bin != bin || !arena->rover) {
+		bin_first(arena, bin, cursor);
+		return false;
+	}
+	cursor->region = arena->rover;
+	read_links(cursor);
+	return true;
+}
+
+// makes the position of the cursor the rover of the arena
+static void
+bin_save_rover(arena_t *arena, size_t bin, struct bin_cursor *cursor)
+{
+	arena->rover_bin = bin;
+	arena->rover = cursor->region;
+}
+#endif
+
+// Every strategy looks first in the bin of the requested size, where
+// regions may still be too small, and then in the next bin with free
+// regions, where every region is big enough. The one in use is chosen
+// with MALLOC_CONF (see tunables.h) and called through strategies.
+
+typedef struct region *(*in_bin_t)(size_t size, arena_t *arena, size_t bin);
+typedef struct region *(*strategy_t)(size_t size, arena_t *arena);
+
+// returns the first region of the bin that holds the size
+static struct region *
+first_in_bin(size_t size, arena_t *arena, size_t bin)
+{
+	struct bin_cursor cursor;
+
+	for (bin_first(arena, bin, &cursor); cursor.region; bin_next(&cursor)) {
+		if (cursor.size >= size)
+			return cursor.region;
+	}
+	return NULL;
+}
+
+// returns the smallest region of the bin that holds the size
+static struct region *
+best_in_bin(size_t size, arena_t *arena, size_t bin)
 {
 	struct region *best_region = NULL;
+	size_t best_size = 0;
+	struct bin_cursor cursor;
 
-	for (int i = 0; i < MAX_BLOCKS; i++) {
-		struct region *current_region = blocks[i];
-		while (current_region != NULL) {
-			// If the region can hold the size
-			if (current_region->size >= size && current_region->free) {
-				// If the region is a better fit than the actual one
-				if (best_region == NULL ||
-				    best_region->size > current_region->size) {
-					best_region = current_region;
-				}
+	for (bin_first(arena, bin, &cursor); cursor.region; bin_next(&cursor)) {
+		// If the region can hold the size
+		if (cursor.size >= size) {
+			// If the region is a better fit than the actual one
+			if (best_region == NULL || best_size > cursor.size) {
+				best_region = cursor.region;
+				best_size = cursor.size;
 			}
-			current_region = current_region->next;
+			if (best_size == size)
+				break;
 		}
 	}
-	// If there is a best_region, set free to false
-	if (best_region != NULL) {
-		best_region->free = false;
+	return best_region;
+}
+
+// returns the first region that holds the size from the rover of the
+// arena, going back to the start of the bin once, and leaves the rover
+// after it. Searches don't start over on the regions that were too
+// small for the last ones.
+static struct region *
+next_in_bin(size_t size, arena_t *arena, size_t bin)
+{
+	struct bin_cursor cursor;
+	bool resumed = bin_resume(arena, bin, &cursor);
+
+	for (;;) {
+		for (; cursor.region; bin_next(&cursor)) {
+			if (cursor.size >= size) {
+				struct region *region = cursor.region;
+				bin_next(&cursor);
+				bin_save_rover(arena, bin, &cursor);
+				return region;
+			}
+		}
+		if (!resumed)
+			return NULL;
+		resumed = false;
+		bin_first(arena, bin, &cursor);
+	}
+}
+
+// returns the first region of the bin that wastes at most
+// good_fit_tolerance percent of the size, or else the smallest of the
+// first good_fit_candidates regions that hold it
+static struct region *
+good_in_bin(size_t size, arena_t *arena, size_t bin)
+{
+	struct region *best_region = NULL;
+	size_t best_size = 0;
+	size_t candidates = 0;
+	size_t tolerance = size <= SIZE_MAX / 100
+	                           ? size * tunables.good_fit_tolerance / 100
+	                           : size / 100 * tunables.good_fit_tolerance;
+	struct bin_cursor cursor;
+
+	for (bin_first(arena, bin, &cursor); cursor.region; bin_next(&cursor)) {
+		if (cursor.size < size)
+			continue;
+		if (cursor.size - size <= tolerance)
+			return cursor.region;
+		if (best_region == NULL || best_size > cursor.size) {
+			best_region = cursor.region;
+			best_size = cursor.size;
+		}
+		if (++candidates >= tunables.good_fit_candidates)
+			break;
 	}
 	return best_region;
 }
-#endif
 
+// takes out of its bin the region in_bin finds in the bin of the size,
+// or else in the next bin with free regions
+static struct region *
+search_bins(size_t size, arena_t *arena, in_bin_t in_bin)
+{
+	size_t bin = size_class(size);
+	struct region *region = in_bin(size, arena, bin);
+
+	if (region == NULL) {
+		bin = next_used_bin(arena, bin + 1);
+		if (bin < BIN_COUNT)
+			region = in_bin(size, arena, bin);
+	}
+
+	if (region != NULL) {
+		bin_remove(region);
+		set_region_free(region, false);
+	}
+	return region;
+}
+
+static struct region *
+first_fit(size_t size, arena_t *arena)
+{
+	return search_bins(size, arena, first_in_bin);
+}
+
+static struct region *
+best_fit(size_t size, arena_t *arena)
+{
+	return search_bins(size, arena, best_in_bin);
+}
+
+static struct region *
+next_fit(size_t size, arena_t *arena)
+{
+	return search_bins(size, arena, next_in_bin);
+}
+
+static struct region *
+good_fit(size_t size, arena_t *arena)
+{
+	return search_bins(size, arena, good_in_bin);
+}
+
+static const strategy_t strategies[STRATEGIES] = {
+	[STRATEGY_FIRST_FIT] = first_fit,
+	[STRATEGY_BEST_FIT] = best_fit,
+	[STRATEGY_NEXT_FIT] = next_fit,
+	[STRATEGY_GOOD_FIT] = good_fit,
+};
+
+// takes a free region that holds the size out of the arena, found with
+// the strategy of the tunables
 struct region *
-create_block(size_t size)
+search_strategy(size_t size, arena_t *arena)
 {
-	arena_t *arena = get_arena(size);
-	block_size_t block_size = arena->block_size;
-	struct region **blocks = arena->blocks;
+	return strategies[tunables.strategy](size, arena);
+}
+
+/// Blocks ///
+
+// Descriptors are carved from chunks mapped just for them
+#define DESCRIPTORS_CHUNK 65536
+
+static struct block *free_descriptors;
+static pthread_mutex_t descriptors_lock = PTHREAD_MUTEX_INITIALIZER;
 
-	void *block =
+static struct block *
+new_descriptor(void)
+{
+	pthread_mutex_lock(&descriptors_lock);
+	if (!free_descriptors) {
+		struct block *chunk = mmap(NULL,
+		                           DESCRIPTORS_CHUNK,
+		                           PROT_READ | PROT_WRITE,
+		                           MAP_PRIVATE | MAP_ANONYMOUS,
+		                           -1,
+		                           0);
+		if (chunk == MAP_FAILED) {
+			pthread_mutex_unlock(&descriptors_lock);
+			return NULL;
+		}
+		for (size_t i = 0; i < DESCRIPTORS_CHUNK / sizeof(struct block); i++) {
+			chunk[i].next = free_descriptors;
+			free_descriptors = &chunk[i];
+		}
+	}
+	struct block *block = free_descriptors;
+	free_descriptors = block->next;
+	pthread_mutex_unlock(&descriptors_lock);
+
+	return block;
+}
+
+static void
+delete_descriptor(struct block *block)
+{
+	pthread_mutex_lock(&descriptors_lock);
+	block->next = free_descriptors;
+	free_descriptors = block;
+	pthread_mutex_unlock(&descriptors_lock);
+}
+
+// pages of the block the page map has to know: the ones of the header
+// and the pointer of a huge region, or every page of other blocks
+static size_t
+mapped_pages_size(struct block *block)
+{
+	return block->kind == HUGE_BLOCK ? 2 * PAGE_SIZE : block->size;
+}
+
+// maps size bytes so that memory + offset is aligned to the alignment,
+// unmapping the pages left over around them
+static void *
+map_pages(size_t size, size_t alignment, size_t offset)
+{
+	size_t extra = alignment > PAGE_SIZE ? alignment : 0;
+	char *memory =
 	        mmap(NULL,
-	             block_size,
+	             size + extra,
 	             PROT_READ | PROT_WRITE,  // Memory is readable and writable
 	             MAP_PRIVATE |
 	                     MAP_ANONYMOUS,  // Memory not backed by a file and anonymous to the process
 	             -1,  // No fd used
 	             0);  // Due to not using a fd, no need to use offset
-	if (block == MAP_FAILED) {
+	if (memory == MAP_FAILED) {
 		return NULL;
 	}
 
-	struct region *new_region = create_region(block, block_size, NULL, NULL);
+	if (extra) {
+		char *start = (char *) (ALIGN_UP((uintptr_t) memory + offset,
+		                                 alignment) -
+		                        offset);
+		if (start > memory)
+			munmap(memory, start - memory);
+		if (start < memory + extra)
+			munmap(start + size, memory + extra - start);
+		memory = start;
+	}
+	return memory;
+}
 
-	bool assigned = false;
-	for (int i = 0; i < MAX_BLOCKS && !assigned; i++) {
-		if (!blocks[i]) {
-			blocks[i] = new_region;
-			assigned = true;
-		}
+// maps size bytes of huge pages with MAP_HUGETLB so that memory + offset
+// is aligned to the alignment. The mapping already comes aligned to
+// HUGE_PAGE_SIZE; for a bigger alignment the huge pages are mapped over
+// an aligned range of address space reserved with normal pages, so no
+// more than size bytes of huge pages are taken.
+static void *
+map_hugetlb_pages(size_t size, size_t alignment, size_t offset)
+{
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+	char *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (memory == MAP_FAILED)
+		return NULL;
+	if (((uintptr_t) memory + offset) % alignment == 0)
+		return memory;
+	munmap(memory, size);
+
+	char *range = mmap(NULL,
+	                   size + alignment,
+	                   PROT_NONE,
+	                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+	                   -1,
+	                   0);
+	if (range == MAP_FAILED)
+		return NULL;
+
+	char *start = (char *) (ALIGN_UP((uintptr_t) range + offset, alignment) -
+	                        offset);
+	memory = mmap(start,
+	              size,
+	              PROT_READ | PROT_WRITE,
+	              flags | MAP_FIXED,
+	              -1,
+	              0);
+	if (start > range)
+		munmap(range, start - range);
+	munmap(start + size, range + alignment - start);
+	if (memory == MAP_FAILED) {
+		munmap(start, size);
+		return NULL;
 	}
-	if (assigned == false) {
-		munmap(block, block_size);
+	return memory;
+}
+
+static void
+link_block(struct block **list, struct block *block)
+{
+	block->prev = NULL;
+	block->next = *list;
+	if (*list)
+		(*list)->prev = block;
+	*list = block;
+}
+
+static void
+unlink_block(struct block **list, struct block *block)
+{
+	if (block->prev)
+		block->prev->next = block->next;
+	else
+		*list = block->next;
+	if (block->next)
+		block->next->prev = block->prev;
+}
+
+// maps a block of at least HUGE_PAGE_SIZE bytes on huge pages, if they
+// are enabled: with MAP_HUGETLB for blocks of regions, whose size is a
+// multiple of them, or advising transparent huge pages. Returns NULL
+// if the block has to be mapped with normal pages.
+static void *
+map_huge_pages(struct block *block,
+               block_kind_t kind,
+               size_t size,
+               size_t alignment,
+               size_t offset)
+{
+	block->huge_pages = false;
+	block->hugetlb = false;
+	if (HUGE_PAGES == HUGE_PAGES_OFF || kind == SLAB_BLOCK ||
+	    size < HUGE_PAGE_SIZE)
 		return NULL;
+
+	void *memory = NULL;
+	if (HUGE_PAGES == HUGE_PAGES_HUGETLB && kind == REGION_BLOCK) {
+		memory = map_hugetlb_pages(size, alignment, offset);
+		block->hugetlb = memory != NULL;
 	}
-	return new_region;
+
+	// Without reserved huge pages MAP_HUGETLB fails, and THP is used
+	if (!memory) {
+		memory = map_pages(size, alignment, offset);
+		if (memory && madvise(memory, size, MADV_HUGEPAGE) != 0)
+			return memory;
+	}
+	block->huge_pages = memory != NULL;
+	return memory;
 }
 
+// maps a new block whose memory + offset is aligned to the alignment,
+// and registers it in its arena (whose set must be locked) and in the
+// page map
+static struct block *
+map_aligned_block(block_kind_t kind,
+                  size_t size,
+                  size_t alignment,
+                  size_t offset,
+                  arena_t *arena)
+{
+	struct block *block = new_descriptor();
+	if (!block) {
+		return NULL;
+	}
+
+	block->memory = map_huge_pages(block, kind, size, alignment, offset);
+	if (!block->memory)
+		block->memory = map_pages(size, alignment, offset);
+	if (!block->memory) {
+		delete_descriptor(block);
+		return NULL;
+	}
+	block->kind = kind;
+	block->size = size;
+	block->arena = arena;
+
+	// The pages set before the map failed to grow can't be left
+	// pointing to the descriptor
+	if (!pagemap_set(block->memory, mapped_pages_size(block), block)) {
+		pagemap_set(block->memory, mapped_pages_size(block), NULL);
+		munmap(block->memory, size);
+
+		delete_descriptor(block);
+		return NULL;
+	}
+
+	block->prev = NULL;
+	block->next = NULL;
+	if (arena) {
+		link_block(&arena->blocks, block);
+		arena->mmaps++;
+		arena->block_count++;
+		arena->mapped += size;
+		arena->resident += size;
+		if (block->huge_pages)
+			arena->huge_pages += size;
+	} else {
+		__atomic_fetch_add(&huge_stats.mmaps, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&huge_stats.mapped, size, __ATOMIC_RELAXED);
+		if (block->huge_pages)
+			__atomic_fetch_add(&huge_stats.huge_pages,
+			                   size,
+			                   __ATOMIC_RELAXED);
+	}
+	return block;
+}
+
+// maps a new block and registers it in its arena (whose set must be
+// locked) and in the page map
+struct block *
+map_block(block_kind_t kind, size_t size, arena_t *arena)
+{
+	return map_aligned_block(kind, size, PAGE_SIZE, 0, arena);
+}
+
+// returns the block that holds the address, or NULL
+// if it's not memory of the library
+struct block *
+get_block(void *ptr)
+{
+	return pagemap_get(ptr);
+}
+
+// returns the region of the pointer if it's the pointer of
+// a region of the block, or NULL
 struct region *
-create_region(void *memory, size_t size, struct region *next, struct region *prev)
+get_block_region(struct block *block, void *ptr)
+{
+	if (block->kind == SLAB_BLOCK ||
+	    (char *) ptr < (char *) block->memory + REGION_HEADER_SIZE)
+		return NULL;
+
+	// The header of a huge region is somewhere in its first page
+	struct region *region = PTR2REGION(ptr);
+	if (region->checksum != MAGIC_BYTES ||
+	    (block->kind == HUGE_BLOCK &&
+	     ((char *) region >= (char *) block->memory + PAGE_SIZE ||
+	      region->arena != HUGE_ARENA)))
+		return NULL;
+	return region;
+}
+
+// unregisters and unmaps the block
+void
+unmap_block(struct block *block)
+{
+	arena_t *arena = block->arena;
+	if (arena) {
+		unlink_block(&arena->blocks, block);
+		arena->munmaps++;
+		arena->block_count--;
+		arena->mapped -= block->size;
+		arena->resident -= block->size;
+		if (block->huge_pages)
+			arena->huge_pages -= block->size;
+	} else {
+		__atomic_fetch_add(&huge_stats.munmaps, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_sub(&huge_stats.mapped, block->size, __ATOMIC_RELAXED);
+		if (block->huge_pages)
+			__atomic_fetch_sub(&huge_stats.huge_pages,
+			                   block->size,
+			                   __ATOMIC_RELAXED);
+	}
+
+	pagemap_set(block->memory, mapped_pages_size(block), NULL);
+	munmap(block->memory, block->size);
+	delete_descriptor(block);
+}
+
+// takes an empty block retained by the arena, or returns NULL
+static struct block *
+reuse_block(arena_t *arena)
+{
+	struct block *block = arena->retained;
+	if (!block)
+		return NULL;
+
+	unlink_block(&arena->retained, block);
+	arena->retained_count--;
+	link_block(&arena->blocks, block);
+
+	// Its region goes back to a bin, which counts it as free
+	struct region *region = block->memory;
+	arena->free_regions--;
+	arena->free -= region->size;
+	arena->allocated += region->size;
+	return block;
+}
+
+// keeps the empty block in its arena for create_block, returns false
+// if the arena already retains as much as it can
+static bool
+retain_block(struct block *block)
+{
+	arena_t *arena = block->arena;
+	if (arena->retained_count + 1 > tunables.retained_blocks ||
+	    (arena->retained_count + 1) * block->size > RETAINED_MAX_SIZE)
+		return false;
+
+	unlink_block(&arena->blocks, block);
+	link_block(&arena->retained, block);
+	arena->retained_count++;
+
+	// Its region is out of the bins, but still free
+	struct region *region = block->memory;
+	arena->free_regions++;
+	arena->free += region->size;
+	arena->allocated -= region->size;
+	REGION2LINKS(region)->freed_at = clock_ms();
+	return true;
+}
+
+struct region *
+create_region(void *memory, size_t size)
 {
 	struct region *new_region = (struct region *) memory;
 
 	new_region->checksum = MAGIC_BYTES;
 	new_region->size = size - REGION_HEADER_SIZE;
-	new_region->next = next;
-	new_region->prev = prev;
 	new_region->free = true;
+	new_region->in_bin = false;
+	new_region->cached = false;
+	new_region->purged = false;
+	new_region->fresh = false;
+	new_region->prev_free = false;
+	new_region->arena = 0;
+
+	return new_region;
+}
+
+// returns true if the region is the first one of its block
+static bool
+is_first_region(struct region *region)
+{
+	return (uintptr_t) region % get_region_arena(region)->block_size == 0;
+}
+
+// returns the region after the given one in its block, or NULL if it's
+// the last one
+struct region *
+region_next(struct region *region)
+{
+	if (region->arena == HUGE_ARENA)
+		return NULL;
+
+	size_t block_size = get_region_arena(region)->block_size;
+	uintptr_t block_end = ALIGN_UP((uintptr_t) region + 1, block_size);
+	uintptr_t next = (uintptr_t) REGION2PTR(region) + region->size;
+
+	return next < block_end ? (struct region *) next : NULL;
+}
+
+// returns the region before the given one in its block if it's free,
+// from the size in its footer, or NULL
+struct region *
+region_prev(struct region *region)
+{
+	if (!region->prev_free)
+		return NULL;
+
+	size_t prev_size = *((size_t *) region - 1);
+	return PTR2REGION((char *) region - prev_size);
+}
 
+// keeps the boundary tags of the region: its footer if it's free, and
+// the prev_free bit of the region after it
+static void
+update_boundary(struct region *region)
+{
+	if (region->free)
+		*REGION_FOOTER(region) = region->size;
+
+	struct region *next = region_next(region);
+	if (next)
+		next->prev_free = region->free;
+}
+
+void
+set_region_free(struct region *region, bool free)
+{
+	region->free = free;
+	update_boundary(region);
+}
+
+struct region *
+create_block(size_t size)
+{
+	arena_t *arena = get_arena(size);
+
+	struct block *block = reuse_block(arena);
+	if (block) {
+		// it keeps the state of its pages
+		struct region *new_region = block->memory;
+		bin_insert(new_region);
+		return new_region;
+	}
+
+	block = map_aligned_block(REGION_BLOCK,
+	                          arena->block_size,
+	                          arena->block_size,
+	                          0,
+	                          arena);
+	if (!block) {
+		return NULL;
+	}
+
+	struct region *new_region = create_region(block->memory, block->size);
+	new_region->arena = arena->id;
+	arena->regions++;
+	arena->allocated += new_region->size;  // until it's in a bin
+	set_region_purged(new_region, true);
+	new_region->fresh = true;  // new pages are zero until written
+	update_boundary(new_region);
+
+	bin_insert(new_region);
 	return new_region;
 }
 
@@ -135,40 +1157,95 @@ void
 splitting(struct region *node, size_t requested_size)
 {
 	// If the minimum new free region doesn't fit in the free space, do nothing
-	if (node->size < requested_size + REGION_HEADER_SIZE + REGION_MIN_SIZE) {
+	size_t min_size = tunables.region_min_size;
+	if (node->size < requested_size + REGION_HEADER_SIZE + min_size) {
 		return;
 	}
 
 	// If the requested_size is less than the minimum, the actual node
-	// must have the REGION_MIN_SIZE
-	if (requested_size < REGION_MIN_SIZE) {
-		requested_size = REGION_MIN_SIZE;
+	// must have the minimum size
+	if (requested_size < min_size) {
+		requested_size = min_size;
 	}
 
+	// A free node changes its size, so it has to change its bin too,
+	// and its purged pages
+	bool in_bin = node->in_bin;
+	bool purged = node->purged;
+	bool fresh = node->fresh;
+	bin_remove(node);
+	set_region_purged(node, false);
+
 	// Get the pointer to the empty region
 	void *ptr_empty_region = REGION2PTR(node);
 	ptr_empty_region += requested_size;
 
 	// Create header metadata where the memory ends
-	struct region *new_region = create_region(
-	        ptr_empty_region, node->size - requested_size, node->next, node);
-
-	// Update prev of next node if exists
-	if (node->next != NULL) {
-		node->next->prev = new_region;
-	}
-	node->next = new_region;  // Update next of current node
+	struct region *new_region =
+	        create_region(ptr_empty_region, node->size - requested_size);
+	new_region->arena = node->arena;
 	node->size = requested_size;
+
+	// The header of the new region is out of its interior
+	arena_t *arena = get_region_arena(node);
+	arena->regions++;
+	arena->allocated -= REGION_HEADER_SIZE;
+	set_region_purged(node, purged);
+	set_region_purged(new_region, purged);
+	node->fresh = fresh;
+	new_region->fresh = fresh;
+
+	update_boundary(node);
+	update_boundary(new_region);
+
+	if (in_bin)
+		bin_insert(node);
+	bin_insert(new_region);
+}
+
+// gives back the space before the first aligned pointer the region
+// (taken out of its bin) can have as a free region, returns the
+// aligned region
+struct region *
+align_region(struct region *region, size_t alignment)
+{
+	uintptr_t ptr = (uintptr_t) REGION2PTR(region);
+	if (ptr % alignment == 0)
+		return region;
+
+	// The space left before the aligned region must be a region too
+	uintptr_t aligned_ptr = ALIGN_UP(ptr + REGION_HEADER_SIZE +
+	                                         tunables.region_min_size,
+	                                 alignment);
+	splitting(region, aligned_ptr - REGION_HEADER_SIZE - ptr);
+
+	struct region *aligned_region = region_next(region);
+	bin_remove(aligned_region);
+	set_region_free(aligned_region, false);
+
+	// Its neighbours were part of a free region, so none of them is free
+	set_region_free(region, true);
+	bin_insert(region);
+
+	return aligned_region;
 }
 
 struct region *
 coalescing(struct region *node)
 {
-	if (node->next && node->next->free) {
-		node = coalesce_regions(node, node->next);
+	struct region *next = region_next(node);
+	if (next && next->free) {
+		node = coalesce_regions(node, next);
+	}
+	struct region *prev = region_prev(node);
+	if (prev) {
+		node = coalesce_regions(prev, node);
 	}
-	if (node->prev && node->prev->free) {
-		node = coalesce_regions(node->prev, node);
+	update_boundary(node);
+
+	// The resulting region is available again
+	if (node->free) {
+		bin_insert(node);
 	}
 	return node;
 }
@@ -176,29 +1253,349 @@ coalescing(struct region *node)
 struct region *
 coalesce_regions(struct region *left, struct region *right)
 {
+	bin_remove(left);
+	bin_remove(right);
+	set_region_purged(left, false);  // the header of right is dirty
+	set_region_purged(right, false);
+
+	arena_t *arena = get_region_arena(left);
+	arena->regions--;
+	arena->allocated += REGION_HEADER_SIZE;
+
+	// The boundary tags are left to the caller, which knows if the
+	// region is used: the footer of a free one may be user data
 	left->size += right->size + REGION_HEADER_SIZE;
-	left->next = right->next;
-	if (right->next) {
-		right->next->prev = left;
-	}
 	return left;
 }
 
 void
 delete_block(struct region *region)
 {
-	if (region->prev || region->next)
+	if (!is_first_region(region) || region_next(region))
 		return;
 
-	arena_t *arena = get_arena(region->size);
-	block_size_t block_size = arena->block_size;
-	struct region **blocks = arena->blocks;
+	bin_remove(region);
+
+	struct block *block = get_block(region);
+	if (retain_block(block))
+		return;
+
+	arena_t *arena = block->arena;
+	arena->regions--;
+	arena->allocated -= region->size;
+	set_region_purged(region, false);  // the whole block leaves resident
+	unmap_block(block);
+}
+
+// gives back an allocated region to its arena
+void
+release_region(struct region *region)
+{
+	arena_t *arena = get_region_arena(region);
+
+	region->free = true;
+	region->purged = false;
+
+	struct region *coalesced_region = coalescing(region);
+
+	delete_block(coalesced_region);
+	purge_arena(arena, clock_ms());
+}
+
+/// Page purging ///
+
+// Regions smaller than this can't have a whole page after their links
+#define PURGE_MIN_SIZE (2 * PAGE_SIZE)
+
+uint64_t
+clock_ms(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// returns the size of the pages of the free region that hold nothing
+// but unused memory, which start at *start
+size_t
+purgeable_pages(struct region *region, void **start)
+{
+	// The links and the footer are kept
+	uintptr_t first = PAGE_ROUND((uintptr_t) (REGION2LINKS(region) + 1));
+	uintptr_t end = (uintptr_t) REGION_FOOTER(region) & ~(PAGE_SIZE - 1);
 
-	for (int i = 0; i < MAX_BLOCKS; i++) {
-		if (blocks[i] == region) {
-			blocks[i] = NULL;
-			munmap(REGION2PTR(region), block_size);
-			return;
+	*start = (void *) first;
+	return end > first ? end - first : 0;
+}
+
+// marks the free region as purged or not, and leaves its purgeable
+// pages out of the resident bytes of its arena while it is. A region
+// that stops being purged isn't fresh either.
+void
+set_region_purged(struct region *region, bool purged)
+{
+	if (!purged)
+		region->fresh = false;
+	if (region->purged == purged)
+		return;
+
+
+	void *start;
+	size_t size = purgeable_pages(region, &start);
+	arena_t *arena = get_region_arena(region);
+	if (purged)
+		arena->resident -= size;
+	else
+		arena->resident += size;
+	region->purged = purged;
+}
+
+// gives back the pages of the free region that hold nothing but
+// unused memory, if it wasn't used for decay_ms since freed_at
+static void
+purge_region(struct region *region, uint64_t freed_at, uint64_t now)
+{
+	if (now - freed_at < tunables.decay_ms || region->purged)
+		return;
+
+	// madvise fails on part of a huge page of a MAP_HUGETLB block, and
+	// regions rarely hold whole ones, so their pages are kept
+	if (HUGE_PAGES == HUGE_PAGES_HUGETLB && get_block(region)->hugetlb)
+		return;
+
+	void *start;
+
+	size_t size = purgeable_pages(region, &start);
+	if (size > 0 && madvise(start, size, PURGE_ADVICE) != 0)
+		return;
+	set_region_purged(region, true);
+
+}
+
+// purges the free regions and retained blocks of the arena (whose set
+// must be locked), looking for them at most once every decay_ms
+void
+purge_arena(arena_t *arena, uint64_t now)
+{
+	if (now - arena->last_purge < tunables.decay_ms)
+		return;
+	arena->last_purge = now;
+
+	for (size_t bin = next_used_bin(arena, size_class(PURGE_MIN_SIZE));
+	     bin < BIN_COUNT;
+	     bin = next_used_bin(arena, bin + 1)) {
+		struct bin_cursor cursor;
+		for (bin_first(arena, bin, &cursor); cursor.region;
+		     bin_next(&cursor)) {
+			if (cursor.size >= PURGE_MIN_SIZE)
+				purge_region(cursor.region, cursor.freed_at, now);
 		}
 	}
+
+	for (struct block *block = arena->retained; block; block = block->next)
+		purge_region(block->memory,
+		             REGION2LINKS((struct region *) block->memory)->freed_at,
+		             now);
+}
+
+/// Statistics ///
+
+// fills the statistics of every arena from its running counts, locking
+// one set at a time, and the ones of huge blocks, returns the number of
+// arenas
+size_t
+collect_arena_stats(struct malloc_arena_stats *arenas,
+                    struct malloc_arena_stats *huge)
+{
+	pthread_once(&arena_sets_once, init_arena_sets);
+
+	for (size_t i = 0; i < arena_sets_count; i++) {
+		// Memory waiting in the stack of remote frees isn't counted
+		pthread_mutex_lock(&arena_sets[i].lock);
+		drain_remote_frees(&arena_sets[i]);
+		for (int kind = 0; kind < ARENA_KINDS; kind++) {
+			arena_t *arena = &arena_sets[i].arenas[kind];
+			arenas[arena->id] = (struct malloc_arena_stats){
+				.blocks = arena->block_count,
+				.retained = (size_t) arena->retained_count *
+				            arena->block_size,
+				.regions = arena->regions,
+				.free_regions = arena->free_regions,
+				.allocated = arena->allocated,
+				.free = arena->free,
+				.mmaps = arena->mmaps,
+				.munmaps = arena->munmaps,
+				.mapped = arena->mapped,
+				.resident = arena->resident,
+				.huge_pages = arena->huge_pages,
+			};
+		}
+
+		pthread_mutex_unlock(&arena_sets[i].lock);
+	}
+
+	*huge = (struct malloc_arena_stats){
+		.mmaps = __atomic_load_n(&huge_stats.mmaps, __ATOMIC_RELAXED),
+		.munmaps = __atomic_load_n(&huge_stats.munmaps, __ATOMIC_RELAXED),
+		.mapped = __atomic_load_n(&huge_stats.mapped, __ATOMIC_RELAXED),
+		.huge_pages =
+		        __atomic_load_n(&huge_stats.huge_pages, __ATOMIC_RELAXED),
+	};
+	huge->blocks = huge->mmaps - huge->munmaps;
+	huge->resident = huge->mapped;
+	return arena_sets_count * ARENA_KINDS;
+}
+
+/// Huge regions ///
+
+// maps a region of its own for the size, rounded up to whole pages,
+// with its header placed so its pointer is aligned to the alignment
+struct region *
+create_huge_region(size_t size, size_t alignment)
+{
+	// Offset of the pointer in the mapping, in its first two pages
+	size_t offset = alignment > PAGE_SIZE
+	                        ? PAGE_SIZE
+	                        : ALIGN_UP(REGION_HEADER_SIZE, alignment);
+
+	struct block *block = map_aligned_block(HUGE_BLOCK,
+	                                        PAGE_ROUND(offset + size),
+	                                        alignment,
+	                                        offset,
+	                                        NULL);
+	if (!block) {
+		return NULL;
+	}
+
+	char *ptr = (char *) block->memory + offset;
+	struct region *region = create_region(
+	        PTR2REGION(ptr), block->size - offset + REGION_HEADER_SIZE);
+	region->arena = HUGE_ARENA;
+	region->free = false;
+
+	return region;
+}
+
+// returns the huge region of the pointer, or NULL if it's not
+// a huge region pointer
+struct region *
+get_huge_region(void *ptr)
+{
+	struct block *block = get_block(ptr);
+
+	if (!block || block->kind != HUGE_BLOCK)
+		return NULL;
+	return get_block_region(block, ptr);
+}
+
+// moves the pages of the huge block to a new mapping of new_size
+// bytes, already registered in the page map, so the contents are
+// never copied
+static struct block *
+move_huge_block(struct block *block, size_t new_size)
+{
+	struct block *new_block = map_block(HUGE_BLOCK, new_size, NULL);
+	if (!new_block) {
+		return NULL;
+	}
+
+	if (mremap(block->memory,
+	           block->size,
+	           new_size,
+	           MREMAP_MAYMOVE | MREMAP_FIXED,
+	           new_block->memory) == MAP_FAILED) {
+		unmap_block(new_block);
+		return NULL;
+	}
+
+	// the old pages are gone with mremap, only the descriptor is left
+	pagemap_set(block->memory, mapped_pages_size(block), NULL);
+	__atomic_fetch_add(&huge_stats.munmaps, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_sub(&huge_stats.mapped, block->size, __ATOMIC_RELAXED);
+	if (block->huge_pages)
+		__atomic_fetch_sub(&huge_stats.huge_pages,
+		                   block->size,
+		                   __ATOMIC_RELAXED);
+	delete_descriptor(block);
+	return new_block;
+}
+
+// grows or shrinks the mapping of the huge region with mremap, so
+// the kernel moves its pages instead of copying them, returns the
+// region (which may have moved) or NULL if it couldn't be resized
+struct region *
+resize_huge_region(struct region *region, size_t size)
+{
+	struct block *block = get_block(region);
+	size_t offset = (char *) region - (char *) block->memory;
+	size_t new_size = PAGE_ROUND(offset + REGION_HEADER_SIZE + size);
+
+	if (new_size != block->size) {
+		// shrinking and growing over free pages don't move the mapping
+		if (mremap(block->memory, block->size, new_size, 0) != MAP_FAILED) {
+			__atomic_fetch_add(&huge_stats.mapped,
+			                   new_size - block->size,
+			                   __ATOMIC_RELAXED);
+			if (block->huge_pages)
+				__atomic_fetch_add(&huge_stats.huge_pages,
+				                   new_size - block->size,
+				                   __ATOMIC_RELAXED);
+			block->size = new_size;
+		} else {
+			block = move_huge_block(block, new_size);
+			if (!block)
+				return NULL;
+		}
+	}
+
+	region = (struct region *) ((char *) block->memory + offset);
+	region->size = new_size - offset - REGION_HEADER_SIZE;
+	return region;
+}
+
+void
+delete_huge_region(struct region *region)
+{
+	unmap_block(get_block(region));
+}
+
+/// Fork ///
+
+// Every lock of the library is taken before fork, so the child gets
+// them in a consistent state: arena sets first, as they are always
+// taken before the descriptors lock.
+
+static void
+prefork(void)
+{
+	pthread_once(&arena_sets_once, init_arena_sets);
+	for (size_t i = 0; i < arena_sets_count; i++)
+		pthread_mutex_lock(&arena_sets[i].lock);
+	pthread_mutex_lock(&descriptors_lock);
+}
+
+static void
+postfork_parent(void)
+{
+	pthread_mutex_unlock(&descriptors_lock);
+	for (size_t i = 0; i < arena_sets_count; i++)
+		pthread_mutex_unlock(&arena_sets[i].lock);
+}
+
+// the child only has the thread that forked, so its locks start over
+static void
+postfork_child(void)
+{
+	pthread_mutex_init(&descriptors_lock, NULL);
+	for (size_t i = 0; i < arena_sets_count; i++)
+		pthread_mutex_init(&arena_sets[i].lock, NULL);
+}
+
+// Registered when the library is loaded, since pthread_atfork may
+// allocate and can't be called from malloc
+__attribute__((constructor)) static void
+register_fork_handlers(void)
+{
+	pthread_atfork(prefork, postfork_parent, postfork_child);
 }
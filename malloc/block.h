@@ -1,55 +1,294 @@
 #ifndef _BLOCK_H_
 #define _BLOCK_H_
 
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 
+// Every pointer is aligned to ALIGNMENT bytes, which the header size
+// is a multiple of
+#define ALIGNMENT 16
+
 #define MAGIC_BYTES 23072000
-#define REGION_MIN_SIZE 256
+#define REGION_MIN_SIZE 256  // the smallest region_min_size (see tunables.h)
 #define REGION_HEADER_SIZE sizeof(struct region)
-#define MAX_BLOCKS 50
 
-#define ALIGN4(s) (((((s) -1) >> 2) << 2) + 4)
+// Regions that don't fit in a large block get a mapping of their own,
+// and belong to no arena
+#define HUGE_ARENA 0xff
+#define HUGE_MAX_SIZE (PTRDIFF_MAX - BLOCK_MAX_SIZE)
+
+// Free regions are indexed in size class bins: one bin for everything
+// below 2^BIN_MIN_SHIFT and then BIN_STEPS bins per power of two
+#define BIN_COUNT 128
+#define BIN_MIN_SHIFT 8
+#define BIN_STEPS_SHIFT 2
+#define BINMAP_BITS (8 * sizeof(unsigned long))
+#define BINMAP_WORDS (BIN_COUNT / BINMAP_BITS)
+
+// Arena sets are independent heaps, each one with its own lock. There
+// are ARENA_SETS of them, or ARENAS_PER_CPU per CPU if it's not defined.
+#ifndef ARENA_SETS
+#define ARENA_SETS 0
+#endif
+#define ARENAS_PER_CPU 4
+#define MAX_ARENA_SETS 64
+#define ARENA_KINDS 3
+
+// Empty blocks are kept by their arena to be reused instead of being
+// unmapped, up to RETAINED_BLOCKS blocks (retained_blocks) and
+// RETAINED_MAX_SIZE bytes, by default a large block, per arena
+#ifndef RETAINED_BLOCKS
+#define RETAINED_BLOCKS 4
+#endif
+#ifndef RETAINED_MAX_SIZE
+#define RETAINED_MAX_SIZE LARGE_BLOCK_SIZE
+#endif
+
+// Free regions give back their interior pages with PURGE_ADVICE once
+// they haven't been used for DECAY_MS milliseconds (decay_ms)
+#ifndef DECAY_MS
+#define DECAY_MS 10000
+#endif
+#ifndef PURGE_ADVICE
+#define PURGE_ADVICE MADV_DONTNEED
+#endif
+
+// Blocks of at least HUGE_PAGE_SIZE bytes (large blocks and huge
+// regions) can use huge pages: with HUGE_PAGES_THP they are advised to
+// use transparent huge pages, and with HUGE_PAGES_HUGETLB blocks of
+// regions are mapped with MAP_HUGETLB, falling back to THP when the
+// system has no huge pages reserved
+#define HUGE_PAGE_SIZE (2UL << 20)
+#define HUGE_PAGES_OFF 0
+#define HUGE_PAGES_THP 1
+#define HUGE_PAGES_HUGETLB 2
+#ifndef HUGE_PAGES
+#define HUGE_PAGES HUGE_PAGES_OFF
+#endif
+
+// Pages given back with MADV_DONTNEED read as zero, so calloc doesn't
+// clear them, but the ones given back with MADV_FREE may keep their
+// contents. Pages of new blocks (fresh) are zero either way.
+
+#define PURGE_ZEROES (PURGE_ADVICE == MADV_DONTNEED)
+
+// With SIDE_TABLE the bins are arrays kept out of the blocks instead of
+// lists linked through the free regions (see struct bin_table)
+
+// Bins are LIFO, the last freed region of a bin is the first one found.
+// With ADDRESS_ORDER they are kept by increasing address instead, which
+// makes inserting a region walk its bin (or search it, with SIDE_TABLE).
+
+// Allocations up to REGION_MIN_SIZE bytes are served from slabs
+// of SLAB_CLASSES slot sizes (see slab.h)
+#define SLAB_CLASSES 12
+
+// Thread locals use the initial-exec model, which never allocates, so
+// they are safe in the shared library too (see libmalloc.so)
+#define THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+
+#define ALIGN16(s) (((((s) -1) >> 4) << 4) + 16)
+#define ALIGN_UP(s, a) (((s) + (a) -1) & ~((a) -1))
+#define IS_POWER_OF_2(n) ((n) != 0 && ((n) & ((n) -1)) == 0)
 #define REGION2PTR(r) ((r) + 1)
 #define PTR2REGION(ptr) ((struct region *) (ptr) -1)
+#define REGION2LINKS(r) ((struct free_links *) REGION2PTR(r))
+#define REGION_FOOTER(r) ((size_t *) ((char *) REGION2PTR(r) + (r)->size) - 1)
 
+// Default sizes of the blocks of each arena, which are powers of two
+// up to BLOCK_MAX_SIZE (see tunables.h)
 typedef enum {
 	SMALL_BLOCK = 16384,
 	MEDIUM_BLOCK = 1048576,
 	LARGE_BLOCK = 33554432
 } block_size_t;
 
+#define BLOCK_MAX_SIZE (1UL << 30)
+
+typedef enum { REGION_BLOCK, SLAB_BLOCK, HUGE_BLOCK } block_kind_t;
+
+// Regions of a block follow each other, so the next one starts where
+// the region ends. Free regions keep their size in the last bytes of
+// their payload (its footer), and the region after a free one has
+// prev_free set, so the previous one is found only when it's free,
+// which is the only time it's needed (to coalesce with it).
+// prev_free is written under the lock by whoever frees the previous
+// region, so it has a byte of its own: the bits are written by the
+// thread that has the region, like cached, which is set without locks.
 struct region {
 	int checksum;
-	bool free;
+	bool free : 1;
+	bool in_bin : 1;
+	bool cached : 1;
+	bool purged : 1;  // its interior pages were given back
+	bool fresh : 1;   // and never written, so they are zero
+	bool prev_free;
+	unsigned char arena;
 	size_t size;
-	struct region *next;
-	struct region *prev;
+};
+
+// Links of the bin a free region belongs to. They are stored in
+// the payload of the region, which is unused while it's free.
+// With SIDE_TABLE a region keeps where its entry is instead, so it's
+// taken out of its bin without searching it.
+struct free_links {
+	struct region *next;  // also links the regions of a thread cache
+	union {
+		struct region *prev;
+		size_t entry;  // index in the table of its bin
+	};
+	uint64_t freed_at;  // milliseconds, to know when to purge it
+};
+
+// Entries of a bin kept in a side table, so searching a bin reads the
+// sizes of its regions without touching their pages. Tables are mapped
+// apart from the blocks and grow by doubling.
+struct bin_entry {
+	struct region *region;
+	size_t size;
+	uint64_t freed_at;
+};
+
+struct bin_table {
+	struct bin_entry *entries;
+	size_t count;
+	size_t capacity;
+};
+
+// Every mapping is described by a block, kept out of the mapping so
+// regions still start at its first byte. The page map takes any address
+// of a block (only the first page for huge ones) to its descriptor.
+// Blocks of regions are aligned to their size, so a region finds the
+// end of its block from its own address.
+struct block {
+	block_kind_t kind;
+	void *memory;
+	size_t size;
+	struct arena *arena;  // NULL for huge blocks
+	bool huge_pages;      // on huge pages, or advised to use them
+	bool hugetlb;         // mapped with MAP_HUGETLB
+	struct block *next;   // blocks of the same arena
+	struct block *prev;
 };
 
 typedef struct arena {
+	unsigned char id;
 	block_size_t block_size;
-	struct region *blocks[MAX_BLOCKS];
+	struct block *blocks;
+	struct block *retained;  // empty blocks kept for reuse
+	unsigned int retained_count;
+	uint64_t last_purge;
+	uint64_t mmaps;  // blocks mapped and unmapped so far
+	uint64_t munmaps;
+	// Running counts for the statistics, retained blocks included
+	size_t block_count;
+	size_t mapped;
+	size_t resident;  // mapped bytes but purged pages
+	size_t huge_pages;
+	size_t regions;       // regions and used slab slots
+	size_t free_regions;  // regions in bins and free slab slots
+	size_t allocated;     // bytes
+	size_t free;          // bytes
+#ifdef SIDE_TABLE
+	struct bin_table bins[BIN_COUNT];
+	size_t rover;  // where next fit resumes in rover_bin
+#else
+	struct region *bins[BIN_COUNT];
+	struct region *rover;
+#endif
+	size_t rover_bin;
+	unsigned long binmap[BINMAP_WORDS];
+	struct slab *slabs[SLAB_CLASSES];  // slabs with free slots
 } arena_t;
 
+typedef struct arena_set {
+	pthread_mutex_t lock;
+	arena_t arenas[ARENA_KINDS];  // small, medium and large
+	void *remote_frees;  // freed by threads of other sets, not locked
+} arena_set_t;
+
+arena_set_t *lock_arena_set(void);
+
+arena_set_t *get_arena_set(arena_t *arena);
+
+arena_set_t *lock_arena_set_of(arena_t *arena);
+
+arena_set_t *lock_region_arena_set(struct region *region);
+
+void unlock_arena_set(arena_set_t *set);
+
+bool is_remote_set(arena_set_t *set);
+
+void push_remote_free(arena_set_t *set, void *ptr);
+
+arena_set_t *get_region_arena_set(struct region *region);
+
 arena_t *get_arena(size_t size);
 
+arena_t *get_region_arena(struct region *region);
+
+size_t size_class(size_t size);
+
+void bin_insert(struct region *region);
+
+void bin_remove(struct region *region);
+
 struct region *find_free_region(size_t size);
 
-struct region *search_strategy(size_t size, struct region **blocks);
+struct region *search_strategy(size_t size, arena_t *arena);
+
+struct block *map_block(block_kind_t kind, size_t size, arena_t *arena);
+
+struct block *get_block(void *ptr);
+
+struct region *get_block_region(struct block *block, void *ptr);
+
+void unmap_block(struct block *block);
 
 struct region *create_block(size_t size);
 
-struct region *
-create_region(void *memory, size_t size, struct region *next, struct region *prev);
+struct region *create_region(void *memory, size_t size);
+
+struct region *region_next(struct region *region);
+
+struct region *region_prev(struct region *region);
+
+void set_region_free(struct region *region, bool free);
+
+void set_region_purged(struct region *region, bool purged);
 
 void splitting(struct region *node, size_t used_size);
 
+struct region *align_region(struct region *region, size_t alignment);
+
 struct region *coalescing(struct region *node);
 
 struct region *coalesce_regions(struct region *left, struct region *right);
 
 void delete_block(struct region *region);
 
+void release_region(struct region *region);
+
+struct malloc_arena_stats;
+
+size_t collect_arena_stats(struct malloc_arena_stats *arenas,
+                           struct malloc_arena_stats *huge);
+
+uint64_t clock_ms(void);
+
+void purge_arena(arena_t *arena, uint64_t now);
+
+size_t purgeable_pages(struct region *region, void **start);
+
+struct region *create_huge_region(size_t size, size_t alignment);
+
+struct region *get_huge_region(void *ptr);
+
+struct region *resize_huge_region(struct region *region, size_t size);
+
+void delete_huge_region(struct region *region);
+
 #endif  // _BLOCK_H_
@@ -0,0 +1,498 @@
+// Benchmarks of the allocator of the process. Run it as is to measure
+// the C library's malloc, or with LD_PRELOAD=./libmalloc-STRATEGY.so
+// to measure the library (see make bench). Every workload runs in a
+// child process, so the peak RSS it reports is only its own.
+//
+//     ./malloc.bench NAME [SCALE]
+//
+// NAME is printed in the results and SCALE multiplies the operations
+// of every workload (1 by default).
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define THREADS 4
+#define OPS 1000000  // operations per thread and workload
+#define SAMPLE_EVERY 8
+#define SAMPLES 65536  // latency samples kept per thread
+#define PAGE 4096
+
+#define CHURN_SLOTS 4096
+#define RING_SIZE 1024
+#define POOL_OBJECTS 10000
+#define POOL_OBJECT_SIZE 64
+#define REALLOC_MAX_SIZE (16 << 20)
+#define FRAG_OBJECTS 100000
+
+struct worker {
+	uint64_t seed;
+	size_t ops;
+	size_t ops_target;
+	size_t samples_count;
+	uint32_t samples[SAMPLES];  // nanoseconds
+	struct ring *ring;          // larson pairs share one
+	bool producer;
+};
+
+struct result {
+	double ops_per_sec;
+	uint32_t p50;
+	uint32_t p99;
+	uint32_t p999;
+	long peak_rss_kb;
+	double fragmentation;
+};
+
+struct workload {
+	const char *name;
+	void *(*run)(void *worker);
+	int threads;
+};
+
+// Single producer, single consumer queue of pointers
+struct ring {
+	void *slots[RING_SIZE];
+	size_t sizes[RING_SIZE];
+	size_t head;  // written by the consumer
+	size_t tail;  // written by the producer
+};
+
+static size_t scale = 1;
+static size_t live_bytes;
+static size_t peak_live_bytes;
+
+/// Utils ///
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// xorshift64, so every run does the same operations
+static uint64_t
+next_random(struct worker *worker)
+{
+	uint64_t x = worker->seed;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	worker->seed = x;
+	return x;
+}
+
+static size_t
+random_size(struct worker *worker, size_t min, size_t max)
+{
+	return min + next_random(worker) % (max - min + 1);
+}
+
+static void
+add_live_bytes(long size)
+{
+	size_t live = __atomic_add_fetch(&live_bytes, size, __ATOMIC_RELAXED);
+	size_t peak = __atomic_load_n(&peak_live_bytes, __ATOMIC_RELAXED);
+
+	while (live > peak &&
+	       !__atomic_compare_exchange_n(&peak_live_bytes,
+	                                    &peak,
+	                                    live,
+	                                    true,
+	                                    __ATOMIC_RELAXED,
+	                                    __ATOMIC_RELAXED))
+		;
+}
+
+// writes a byte of every page, like a program using the memory would
+static void
+touch(char *ptr, size_t size)
+{
+	for (size_t offset = 0; offset < size; offset += PAGE)
+		ptr[offset] = 1;
+	ptr[size - 1] = 1;
+}
+
+static void
+record_latency(struct worker *worker, uint64_t start)
+{
+	worker->samples[worker->samples_count++ % SAMPLES] = now_ns() - start;
+}
+
+/// Timed operations ///
+
+static void *
+bench_malloc(struct worker *worker, size_t size)
+{
+	void *ptr;
+
+	if (worker->ops++ % SAMPLE_EVERY == 0) {
+		uint64_t start = now_ns();
+		ptr = malloc(size);
+		record_latency(worker, start);
+	} else {
+		ptr = malloc(size);
+	}
+	if (!ptr) {
+		fprintf(stderr, "malloc(%zu) failed\n", size);
+		exit(EXIT_FAILURE);
+	}
+
+	touch(ptr, size);
+	add_live_bytes(size);
+	return ptr;
+}
+
+static void *
+bench_realloc(struct worker *worker, void *ptr, size_t old_size, size_t size)
+{
+	void *new_ptr;
+
+	if (worker->ops++ % SAMPLE_EVERY == 0) {
+		uint64_t start = now_ns();
+		new_ptr = realloc(ptr, size);
+		record_latency(worker, start);
+	} else {
+		new_ptr = realloc(ptr, size);
+	}
+	if (!new_ptr) {
+		fprintf(stderr, "realloc(%zu) failed\n", size);
+		exit(EXIT_FAILURE);
+	}
+
+	touch(new_ptr, size);
+	add_live_bytes((long) size - (long) old_size);
+	return new_ptr;
+}
+
+static void
+bench_free(struct worker *worker, void *ptr, size_t size)
+{
+	if (worker->ops++ % SAMPLE_EVERY == 0) {
+		uint64_t start = now_ns();
+		free(ptr);
+		record_latency(worker, start);
+	} else {
+		free(ptr);
+	}
+	add_live_bytes(-(long) size);
+}
+
+/// Workloads ///
+
+// random sizes, mostly small, replacing random live objects
+static void *
+churn(void *arg)
+{
+	struct worker *worker = arg;
+	void *slots[CHURN_SLOTS] = { 0 };
+	size_t sizes[CHURN_SLOTS];
+
+	while (worker->ops < worker->ops_target) {
+		size_t slot = next_random(worker) % CHURN_SLOTS;
+		if (slots[slot])
+			bench_free(worker, slots[slot], sizes[slot]);
+
+		size_t kind = next_random(worker) % 100;
+		sizes[slot] = kind < 80   ? random_size(worker, 16, 512)
+		              : kind < 98 ? random_size(worker, 512, 8192)
+		                          : random_size(worker, 8192, 262144);
+		slots[slot] = bench_malloc(worker, sizes[slot]);
+	}
+
+	for (size_t slot = 0; slot < CHURN_SLOTS; slot++) {
+		if (slots[slot])
+			bench_free(worker, slots[slot], sizes[slot]);
+	}
+	return NULL;
+}
+
+// objects allocated by a thread and freed by another one: even workers
+// produce into the ring they share with the next odd worker
+static void *
+larson(void *arg)
+{
+	struct worker *worker = arg;
+	struct ring *ring = worker->ring;
+
+	while (worker->ops < worker->ops_target) {
+		if (worker->producer) {
+			size_t tail = ring->tail;
+			if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) ==
+			    RING_SIZE) {
+				sched_yield();
+				continue;
+			}
+			size_t size = random_size(worker, 16, 1024);
+			ring->slots[tail % RING_SIZE] = bench_malloc(worker, size);
+			ring->sizes[tail % RING_SIZE] = size;
+			__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+		} else {
+			size_t head = ring->head;
+			if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+				sched_yield();
+				continue;
+			}
+			bench_free(worker,
+			           ring->slots[head % RING_SIZE],
+			           ring->sizes[head % RING_SIZE]);
+			__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+		}
+	}
+	return NULL;
+}
+
+// many objects of a single size, allocated and freed in random order
+static void *
+pool(void *arg)
+{
+	struct worker *worker = arg;
+	void **objects = calloc(POOL_OBJECTS, sizeof(void *));
+
+	while (worker->ops < worker->ops_target) {
+		for (size_t i = 0; i < POOL_OBJECTS; i++)
+			objects[i] = bench_malloc(worker, POOL_OBJECT_SIZE);
+
+		for (size_t i = POOL_OBJECTS - 1; i > 0; i--) {
+			size_t j = next_random(worker) % (i + 1);
+			void *object = objects[i];
+			objects[i] = objects[j];
+			objects[j] = object;
+		}
+
+		for (size_t i = 0; i < POOL_OBJECTS; i++)
+			bench_free(worker, objects[i], POOL_OBJECT_SIZE);
+	}
+
+	free(objects);
+	return NULL;
+}
+
+// buffers that grow by half their size until they are big, like
+// vectors and strings being appended to
+static void *
+realloc_growth(void *arg)
+{
+	struct worker *worker = arg;
+
+	while (worker->ops < worker->ops_target) {
+		size_t size = random_size(worker, 16, 64);
+		size_t max_size = next_random(worker) % 8 == 0 ? REALLOC_MAX_SIZE
+		                                               : 65536;
+		char *buffer = bench_malloc(worker, size);
+
+		while (size < max_size) {
+			size_t new_size = size + size / 2;
+			buffer = bench_realloc(worker, buffer, size, new_size);
+			size = new_size;
+		}
+		bench_free(worker, buffer, size);
+	}
+	return NULL;
+}
+
+// fills the heap with small objects, frees every other one and then
+// allocates objects that don't fit in the holes
+static void *
+fragmentation(void *arg)
+{
+	struct worker *worker = arg;
+	void **objects = calloc(FRAG_OBJECTS, sizeof(void *));
+	size_t *sizes = calloc(FRAG_OBJECTS, sizeof(size_t));
+
+	while (worker->ops < worker->ops_target) {
+		for (size_t i = 0; i < FRAG_OBJECTS; i++) {
+			sizes[i] = random_size(worker, 16, 2048);
+			objects[i] = bench_malloc(worker, sizes[i]);
+		}
+		for (size_t i = 0; i < FRAG_OBJECTS; i += 2)
+			bench_free(worker, objects[i], sizes[i]);
+		for (size_t i = 0; i < FRAG_OBJECTS; i += 2) {
+			sizes[i] = random_size(worker, 2048, 8192);
+			objects[i] = bench_malloc(worker, sizes[i]);
+		}
+		for (size_t i = 0; i < FRAG_OBJECTS; i++)
+			bench_free(worker, objects[i], sizes[i]);
+	}
+
+	free(objects);
+	free(sizes);
+	return NULL;
+}
+
+static const struct workload workloads[] = {
+	{ "churn", churn, THREADS },
+	{ "larson", larson, THREADS },
+	{ "pool", pool, THREADS },
+	{ "realloc", realloc_growth, THREADS },
+	{ "fragmentation", fragmentation, 1 },
+};
+
+/// Runner ///
+
+static int
+compare_samples(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a;
+	uint32_t y = *(const uint32_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+static long
+peak_rss_kb(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+// runs the workload in this process, writing its results
+static void
+run_workload(const struct workload *workload, struct result *result)
+{
+	// Workers are big and shared by threads, so they don't use the
+	// allocator being measured
+	size_t workers_size = workload->threads * sizeof(struct worker);
+	struct worker *workers = mmap(NULL,
+	                              workers_size,
+	                              PROT_READ | PROT_WRITE,
+	                              MAP_PRIVATE | MAP_ANONYMOUS,
+	                              -1,
+	                              0);
+	struct ring *rings = mmap(NULL,
+	                          workload->threads * sizeof(struct ring),
+	                          PROT_READ | PROT_WRITE,
+	                          MAP_PRIVATE | MAP_ANONYMOUS,
+	                          -1,
+	                          0);
+	pthread_t threads[THREADS];
+	long base_rss_kb = peak_rss_kb();
+
+	for (int i = 0; i < workload->threads; i++) {
+		workers[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+		workers[i].ops_target = OPS * scale;
+		workers[i].ring = &rings[i / 2];
+		workers[i].producer = i % 2 == 0;
+	}
+
+	uint64_t start = now_ns();
+	for (int i = 0; i < workload->threads; i++)
+		pthread_create(&threads[i], NULL, workload->run, &workers[i]);
+	for (int i = 0; i < workload->threads; i++)
+		pthread_join(threads[i], NULL);
+	uint64_t elapsed = now_ns() - start;
+
+	// Objects still in the larson rings
+	for (int i = 0; i < workload->threads; i += 2) {
+		struct ring *ring = &rings[i / 2];
+		for (; ring->head != ring->tail; ring->head++)
+			free(ring->slots[ring->head % RING_SIZE]);
+	}
+
+	// Samples of every worker are sorted together
+	size_t samples_size = workload->threads * SAMPLES * sizeof(uint32_t);
+	uint32_t *samples = mmap(NULL,
+	                         samples_size,
+	                         PROT_READ | PROT_WRITE,
+	                         MAP_PRIVATE | MAP_ANONYMOUS,
+	                         -1,
+	                         0);
+	size_t samples_count = 0;
+	size_t ops = 0;
+	for (int i = 0; i < workload->threads; i++) {
+		size_t count = workers[i].samples_count < SAMPLES
+		                       ? workers[i].samples_count
+		                       : SAMPLES;
+		memcpy(samples + samples_count,
+		       workers[i].samples,
+		       count * sizeof(uint32_t));
+		samples_count += count;
+		ops += workers[i].ops;
+	}
+	qsort(samples, samples_count, sizeof(uint32_t), compare_samples);
+
+	result->ops_per_sec = ops / (elapsed / 1e9);
+	result->p50 = samples[samples_count * 50 / 100];
+	result->p99 = samples[samples_count * 99 / 100];
+	result->p999 = samples[samples_count * 999 / 1000];
+	result->peak_rss_kb = peak_rss_kb() - base_rss_kb;
+	result->fragmentation =
+	        peak_live_bytes ? result->peak_rss_kb * 1024.0 / peak_live_bytes : 0;
+
+	munmap(samples, samples_size);
+	munmap(rings, workload->threads * sizeof(struct ring));
+	munmap(workers, workers_size);
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s NAME [SCALE]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (argc > 2)
+		scale = strtoul(argv[2], NULL, 10);
+
+	struct result *result = mmap(NULL,
+	                             sizeof(struct result),
+	                             PROT_READ | PROT_WRITE,
+	                             MAP_SHARED | MAP_ANONYMOUS,
+	                             -1,
+	                             0);
+
+	printf("%-10s %-14s %12s %8s %8s %8s %12s %6s\n",
+	       "allocator",
+	       "workload",
+	       "ops/s",
+	       "p50 ns",
+	       "p99 ns",
+	       "p999 ns",
+	       "peak RSS KB",
+	       "frag");
+
+	for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+		const struct workload *workload = &workloads[i];
+		pid_t pid = fork();
+		if (pid == 0) {
+			run_workload(workload, result);
+			_exit(EXIT_SUCCESS);
+		}
+
+		int status;
+		waitpid(pid, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+			printf("%-10s %-14s failed\n", argv[1], workload->name);
+			continue;
+		}
+
+		printf("%-10s %-14s %12.0f %8u %8u %8u %12ld %6.2f\n",
+		       argv[1],
+		       workload->name,
+		       result->ops_per_sec,
+		       result->p50,
+		       result->p99,
+		       result->p999,
+		       result->peak_rss_kb,
+		       result->fragmentation);
+		fflush(stdout);
+	}
+	return EXIT_SUCCESS;
+}
@@ -1,69 +1,396 @@
 #define _DEFAULT_SOURCE
 
-#include <assert.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
 
 #include "malloc.h"
+#include "pagemap.h"
 #include "printfmt.h"
+#include "slab.h"
+#include "stats.h"
+#include "tcache.h"
+#include "trace.h"
+#include "tunables.h"
 
-int amount_of_mallocs = 0;
-int amount_of_frees = 0;
-int requested_memory = 0;
-int amount_of_blocks = 0;
+// returns a slab slot for the size
+static void *
+malloc_slot(size_t size)
+{
+	void *ptr = tcache_get_slot(slab_class(size));
 
-/// Public API of malloc library ///
+	if (!ptr) {
+		arena_set_t *set = lock_arena_set();
+		ptr = slab_malloc(size);
+		unlock_arena_set(set);
+	}
+	return ptr;
+}
 
-void *
-malloc(size_t size)
+// size of the free region that holds a region of the size with its
+// pointer aligned to the alignment, and the space before it
+static size_t
+aligned_size(size_t size, size_t alignment)
 {
-	if (size + REGION_HEADER_SIZE > LARGE_BLOCK || size == 0)
-		return NULL;
+	if (alignment <= ALIGNMENT)
+		return size;
+	return size + alignment + REGION_HEADER_SIZE + tunables.region_min_size;
+}
 
-	struct region *region;
+// returns a region for the size, aligned to the alignment, from the
+// thread cache or an arena. Sets purged if its interior pages are
+// zero: never written, or given back with an advice that zeroes them.
+static struct region *
+malloc_region(size_t size, size_t alignment, bool *purged)
+{
+	struct region *region = alignment <= ALIGNMENT ? tcache_get(size) : NULL;
+	bool new_block = false;
 
-	size = ALIGN4(size);  // aligns to multiple of 4 bytes
+	*purged = false;
+	if (!region) {
+		size_t needed = aligned_size(size, alignment);
+		arena_set_t *set = lock_arena_set();
+		region = find_free_region(needed);
 
-	region = find_free_region(size);
+		if (!region) {
+			region = create_block(needed);
+			if (!region) {
+				unlock_arena_set(set);
+				return NULL;
+			}
+			bin_remove(region);  // the new block is used right away
+			new_block = true;
+		}
 
-	if (!region) {
-		region = create_block(size);
+		set_region_free(region, false);
+		if (alignment > ALIGNMENT)
+			region = align_region(region, alignment);
+		splitting(region, size);
+		*purged = region->purged && (region->fresh || PURGE_ZEROES);
+
+		set_region_purged(region, false);  // it's only tracked while free
+		unlock_arena_set(set);
+	}
+
+	if (new_block)
+		stats_block();  // updates statistics
+	return region;
+}
+
+// takes up to n slots of the size from the slabs of the thread's
+// arena set with a single lock, returns how many it got
+static size_t
+malloc_slots(size_t size, size_t n, void **ptrs)
+{
+	size_t count = 0;
+	arena_set_t *set = lock_arena_set();
+
+	while (count < n && (ptrs[count] = slab_malloc(size)))
+		count++;
+	unlock_arena_set(set);
+	return count;
+}
+
+// carves up to n regions of the size one after the other, each one
+// out of the free remainder of the previous one, from free regions of
+// the arena of the size that hold as many of them as possible. Returns
+// how many it got, and adds the blocks it creates to new_blocks.
+static size_t
+malloc_regions(size_t size, size_t n, void **ptrs, size_t *new_blocks)
+{
+	size_t count = 0;
+	arena_set_t *set = lock_arena_set();
+	arena_t *arena = get_arena(size);
+	size_t max_regions = arena->block_size / (size + REGION_HEADER_SIZE);
+
+	while (count < n) {
+		size_t regions = n - count < max_regions ? n - count : max_regions;
+		size_t needed = regions * (size + REGION_HEADER_SIZE) -
+		                REGION_HEADER_SIZE;
+
+		// needed fits in a block of the arena, so new blocks are its own
+		struct region *region = search_strategy(needed, arena);
 		if (!region) {
-			errno = ENOMEM;
-			return NULL;
+			region = create_block(needed);
+			if (region) {
+				bin_remove(region);
+				(*new_blocks)++;
+			}
+		}
+		if (!region)
+			region = find_free_region(size);
+		if (!region)
+			break;
+
+		set_region_free(region, false);
+		for (;;) {
+			splitting(region, size);
+			// purged pages are only tracked while free
+			set_region_purged(region, false);
+			ptrs[count++] = REGION2PTR(region);
+
+			struct region *next = region_next(region);
+			if (count == n || !next || !next->free || next->size < size)
+				break;
+			bin_remove(next);
+			set_region_free(next, false);
+			region = next;
 		}
-		amount_of_blocks++;  // updates statistics
 	}
-	amount_of_mallocs++;  // updates statistics
-	requested_memory += size;
+	unlock_arena_set(set);
+	return count;
+}
 
-	region->free = false;
-	splitting(region, size);
+// gives back a slot of the class, looking for its slab only if
+// the thread cache is full
+static void
+free_class_slot(size_t class, void *ptr)
+{
+	if (tcache_holds_slot(class, ptr))
+		return;
 
-	return REGION2PTR(region);
+	if (!tcache_put_slot(class, ptr)) {
+		struct slab *slab = get_slab(ptr);
+		arena_set_t *set = get_arena_set(slab->arena);
+		if (is_remote_set(set)) {
+			push_remote_free(set, ptr);
+		} else {
+			lock_arena_set_of(slab->arena);
+			slab_free(slab, ptr);
+			unlock_arena_set(set);
+		}
+	}
+
+	stats_free(slab_class_size(class));  // updates statistics
+}
+
+static void
+free_slot(struct slab *slab, void *ptr)
+{
+	free_class_slot(slab->class, ptr);
+}
+
+// gives back a region of a block or a huge region
+static void
+free_region(struct region *region, bool huge)
+{
+	size_t size = region->size;
+
+	if (huge) {
+		delete_huge_region(region);
+		stats_free(size);  // updates statistics
+		return;
+	}
+
+	if (region->free == true || region->cached == true)
+		return;
+
+	if (!tcache_put(region)) {
+		arena_set_t *set = get_region_arena_set(region);
+		if (is_remote_set(set)) {
+			region->cached = true;  // until its set releases it
+			push_remote_free(set, REGION2PTR(region));
+		} else {
+			lock_arena_set_of(get_region_arena(region));
+			release_region(region);
+			unlock_arena_set(set);
+		}
+	}
+
+	stats_free(size);  // updates statistics
+}
+
+// zeroes the first size bytes of the region, except for the interior
+// pages it has if it was purged, which are still zero
+static void
+clear_region(struct region *region, size_t size, bool purged)
+{
+	char *ptr = (char *) REGION2PTR(region);
+	char *end = ptr + size;
+	void *start;
+	size_t clean_size = purged ? purgeable_pages(region, &start) : 0;
+
+	if (clean_size == 0) {
+		memset(ptr, 0, size);
+		return;
+	}
+
+	char *clean_start = start;
+	char *clean_end = clean_start + clean_size;
+	memset(ptr, 0, (clean_start < end ? clean_start : end) - ptr);
+	if (clean_end < end)
+		memset(clean_end, 0, end - clean_end);
+}
+
+// returns true if an allocation of the size, aligned to 16 bytes, and
+// the alignment gets a mapping of its own
+static bool
+is_huge(size_t size, size_t alignment)
+{
+	return aligned_size(size, alignment) + REGION_HEADER_SIZE >
+	       LARGE_BLOCK_SIZE;
+}
+
+// allocates size bytes aligned to the alignment, a power of two, and
+// zeroes them if zero is set
+static void *
+allocate(size_t size, size_t alignment, bool zero)
+{
+	if (!tunables.loaded)
+		load_tunables();  // before the sizes of blocks are first used
+	if (size == 0)
+		return NULL;
+	if (size > HUGE_MAX_SIZE || alignment > HUGE_MAX_SIZE) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	void *ptr;
+	size_t usable_size;
+
+	size = ALIGN16(size);  // aligns to multiple of 16 bytes
+	if (alignment > ALIGNMENT && size < REGION_MIN_SIZE)
+		size = REGION_MIN_SIZE;  // so the aligned region can be split
+
+	if (alignment <= ALIGNMENT && size <= SLAB_MAX_SIZE) {
+		ptr = malloc_slot(size);
+		usable_size = slab_class_size(slab_class(size));
+		if (ptr && zero)
+			memset(ptr, 0, size);
+	} else if (!is_huge(size, alignment)) {
+		bool purged;
+		struct region *region = malloc_region(size, alignment, &purged);
+		ptr = region ? REGION2PTR(region) : NULL;
+		usable_size = region ? region->size : 0;
+		if (region && zero)
+			clear_region(region, size, purged);
+	} else {
+		// Huge regions are always new mappings, which are zero
+		struct region *region = create_huge_region(size, alignment);
+		ptr = region ? REGION2PTR(region) : NULL;
+		usable_size = region ? region->size : 0;
+		if (region)
+			stats_block();  // updates statistics
+	}
+	if (!ptr) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	stats_malloc(usable_size);  // updates statistics
+
+	return ptr;
+}
+
+// allocates for an entry point of the API, recording it in the trace
+static void *
+traced_allocate(size_t size, size_t alignment)
+{
+	void *ptr = allocate(size, alignment, false);
+	if (ptr)
+		TRACE(TRACE_MALLOC, ptr, NULL, size);
+	return ptr;
+}
+
+// gives back the memory of the pointer, ignoring the ones that are
+// not memory of the library
+static void
+release(void *ptr)
+{
+	if (!ptr)
+		return;
+
+	struct block *block = get_block(ptr);
+	if (!block)  // not memory of the library
+		return;
+
+	if (block->kind == SLAB_BLOCK) {
+		free_slot(block->memory, ptr);
+		return;
+	}
+
+	struct region *region = get_block_region(block, ptr);
+	if (!region)
+		return;
+
+	free_region(region, block->kind == HUGE_BLOCK);
+}
+
+/// Public API of malloc library ///
+
+void *
+malloc(size_t size)
+{
+	return traced_allocate(size, ALIGNMENT);
 }
 
 void
 free(void *ptr)
+{
+	if (ptr)
+		TRACE(TRACE_FREE, ptr, NULL, 0);
+	release(ptr);
+}
+
+// Sized frees trust the size they are given, which tells where the
+// pointer lives as malloc chose it: a slab slot of its class up to
+// SLAB_MAX_SIZE, a huge region when it doesn't fit in a large block,
+// or a region of a block. Neither the page map nor the checksum of the
+// header are looked at; the header of a region is still read and
+// written to give it back, slots have none.
+
+void
+free_sized(void *ptr, size_t size)
 {
 	if (!ptr)
 		return;
+	TRACE(TRACE_FREE, ptr, NULL, 0);
 
-	struct region *region = PTR2REGION(ptr);
-	if (region->checksum != MAGIC_BYTES)
+	size = ALIGN16(size);
+	if (size <= SLAB_MAX_SIZE) {
+		free_class_slot(slab_class(size), ptr);
 		return;
+	}
+
+	free_region(PTR2REGION(ptr), is_huge(size, ALIGNMENT));
+}
 
-	if (region->free == true)
+void
+free_aligned_sized(void *ptr, size_t alignment, size_t size)
+{
+	if (alignment <= ALIGNMENT) {
+		free_sized(ptr, size);
+		return;
+	}
+	if (!ptr)
 		return;
-	region->free = true;
+	TRACE(TRACE_FREE, ptr, NULL, 0);
+
+	size = ALIGN16(size);
+	if (size < REGION_MIN_SIZE)
+		size = REGION_MIN_SIZE;
+
+	free_region(PTR2REGION(ptr), is_huge(size, alignment));
+}
 
-	struct region *coalesced_region = coalescing(region);
+size_t
+malloc_usable_size(void *ptr)
+{
+	if (!ptr)
+		return 0;
 
-	delete_block(coalesced_region);
+	struct block *block = get_block(ptr);
+	if (!block)  // not memory of the library
+		return 0;
+
+	if (block->kind == SLAB_BLOCK) {
+		struct slab *slab = block->memory;
+		return slab->slot_size;
+	}
 
-	amount_of_frees++;  // updates statistics
+	struct region *region = get_block_region(block, ptr);
+	return region ? region->size : 0;
 }
 
 void *
@@ -80,74 +407,452 @@ calloc(size_t nmemb, size_t size)
 		return NULL;
 	}
 
-	void *ptr = malloc(total_size);  // Call malloc to allocate memory
+	// Memory known to be zero isn't cleared again
+	void *ptr = allocate(total_size, ALIGNMENT, true);
 	if (ptr == NULL) {
 		return NULL;
 	}
-
-	memset(ptr, 0, total_size);  // Initialize the allocated memory with zeros
+	TRACE(TRACE_MALLOC, ptr, NULL, total_size);
 
 	return ptr;
 }
 
 void *
-realloc(void *ptr, size_t size)
+reallocarray(void *ptr, size_t nmemb, size_t size)
 {
-	if (!ptr) {
-		return malloc(size);
-	} else if (size == 0) {
-		free(ptr);
+	size_t total_size = nmemb * size;
+
+	if (nmemb != 0 &&
+	    total_size / nmemb != size) {  // Check for integer overflow
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return realloc(ptr, total_size);
+}
+
+// keeps the slot if the size still fits in it, or moves its
+// contents to a new allocation
+static void *
+realloc_slot(struct slab *slab, void *ptr, size_t size)
+{
+	size = ALIGN16(size);
+	if (size <= slab->slot_size && slab_class(size) == slab->class) {
+		return ptr;
+	}
+
+	void *new_ptr = allocate(size, ALIGNMENT, false);
+	if (!new_ptr) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memcpy(new_ptr, ptr, size < slab->slot_size ? size : slab->slot_size);
+	free_slot(slab, ptr);
+	return new_ptr;
+}
+
+// remaps the region if the size is still huge, so its contents are
+// never copied, or moves them to an arena
+static void *
+realloc_huge(struct region *region, void *ptr, size_t size)
+{
+	size_t old_size = region->size;
+
+	size = ALIGN16(size);
+	if (size + REGION_HEADER_SIZE > LARGE_BLOCK_SIZE) {
+		struct region *new_region = resize_huge_region(region, size);
+		if (new_region) {
+			stats_resize(old_size, new_region->size);  // updates statistics
+			return REGION2PTR(new_region);
+		}
+	}
+
+	void *new_ptr = allocate(size, ALIGNMENT, false);
+	if (!new_ptr) {
+		errno = ENOMEM;
 		return NULL;
 	}
+	memcpy(new_ptr, ptr, size < old_size ? size : old_size);
+	release(ptr);
+	return new_ptr;
+}
 
-	struct region *region = PTR2REGION(ptr);
-	size = ALIGN4(size);
-	requested_memory -= region->size;
-	if (region->checksum != MAGIC_BYTES)
+// moves or resizes the memory of a pointer to a size, neither of them zero
+static void *
+reallocate(void *ptr, size_t size)
+{
+	struct block *block = get_block(ptr);
+	if (!block)  // not memory of the library
+		return NULL;
+
+	if (block->kind == SLAB_BLOCK) {
+		return realloc_slot(block->memory, ptr, size);
+	}
+
+	struct region *region = get_block_region(block, ptr);
+	if (!region)
 		return NULL;
 
-	if (size > region->size) {  // Get bigger region
-		if (region->next && region->next->free &&
-		    (region->size + region->next->size + REGION_HEADER_SIZE >=
+	if (block->kind == HUGE_BLOCK) {
+		return realloc_huge(region, ptr, size);
+	}
+
+	size = ALIGN16(size);
+
+	arena_set_t *set = lock_region_arena_set(region);
+	size_t old_size = region->size;
+	bool moved = false;
+
+	if (size <= SLAB_MAX_SIZE) {  // small sizes always live in slabs
+		moved = true;
+
+	} else if (size > region->size) {  // Get bigger region
+		struct region *next = region_next(region);
+		struct region *prev = region_prev(region);  // only if it's free
+
+		if (next && next->free &&
+		    (region->size + next->size + REGION_HEADER_SIZE >=
 		     size)) {  // Coalesce with right region
-			region = coalesce_regions(region, region->next);
+			region = coalesce_regions(region, next);
 			splitting(region, size);
+			set_region_free(region, false);
 
-		} else if (region->prev && region->prev->free &&
-		           (region->size + region->prev->size + REGION_HEADER_SIZE >=
-		            size)) {  // Coalesce with left region
-			region = coalesce_regions(region->prev, region);
-			memcpy(REGION2PTR(region), ptr, size);
+		} else if (prev && (region->size + prev->size +
+		                    REGION_HEADER_SIZE >=
+		                    size)) {  // Coalesce with left region
+			region = coalesce_regions(prev, region);
+			memmove(REGION2PTR(region), ptr, old_size);
 			splitting(region, size);
-			region->free = false;
+			set_region_free(region, false);
 
 		} else {  // Find new region or create new block
-			void *new_ptr = malloc(size);
-			amount_of_mallocs--;
-			if (!new_ptr) {
-				errno = ENOMEM;
-				return NULL;
-			}
-			memcpy(new_ptr, ptr, region->size);
-			free(ptr);
-			region = PTR2REGION(new_ptr);
+			moved = true;
 		}
 
 	} else if (size < region->size) {  // Shrink region
 		splitting(region, size);
-		if (region->next)
-			coalescing(region->next);
+		struct region *next = region_next(region);
+		if (next)
+			coalescing(next);
+	}
+	size_t new_size = region->size;
+	unlock_arena_set(set);
+
+	if (moved) {
+		void *new_ptr = allocate(size, ALIGNMENT, false);
+		if (!new_ptr) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		memcpy(new_ptr, ptr, size < old_size ? size : old_size);
+		release(ptr);
+		return new_ptr;
 	}
 	// If it's the same size, return the same pointer
-	requested_memory += size;
+	stats_resize(old_size, new_size);  // updates statistics
 	return REGION2PTR(region);
 }
 
+void *
+realloc(void *ptr, size_t size)
+{
+	if (!ptr) {
+		return malloc(size);
+	} else if (size == 0) {
+		free(ptr);
+		return NULL;
+	}
+
+	void *new_ptr = reallocate(ptr, size);
+	if (new_ptr)
+		TRACE(TRACE_REALLOC, new_ptr, ptr, size);
+	return new_ptr;
+}
+
+int
+posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	if (!IS_POWER_OF_2(alignment) || alignment % sizeof(void *) != 0)
+		return EINVAL;
+
+	int saved_errno = errno;  // errno is left as it was
+	void *ptr = traced_allocate(size, alignment);
+	if (!ptr && size != 0) {
+		errno = saved_errno;
+		return ENOMEM;
+	}
+
+	*memptr = ptr;
+	return 0;
+}
+
+void *
+aligned_alloc(size_t alignment, size_t size)
+{
+	if (!IS_POWER_OF_2(alignment)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return traced_allocate(size, alignment);
+}
+
+void *
+memalign(size_t alignment, size_t size)
+{
+	// Alignments that aren't a power of two are rounded up to one
+	if (alignment > HUGE_MAX_SIZE) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (!IS_POWER_OF_2(alignment))
+		alignment = alignment ? 1UL << (8 * sizeof(alignment) -
+		                                __builtin_clzl(alignment))
+		                      : ALIGNMENT;
+	return traced_allocate(size, alignment);
+}
+
+void *
+valloc(size_t size)
+{
+	return traced_allocate(size, PAGE_SIZE);
+}
+
+void *
+pvalloc(size_t size)
+{
+	if (size > HUGE_MAX_SIZE) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return traced_allocate(PAGE_ROUND(size), PAGE_SIZE);
+}
+
+/// Batches ///
+
+// allocates n pointers of the size in ptrs, taking the lock of the
+// arena set once for all of them, returns how many it allocated
+// (setting errno if it's less than n). They skip the thread cache.
+size_t
+malloc_batch(size_t size, size_t n, void **ptrs)
+{
+	if (!tunables.loaded)
+		load_tunables();
+	if (size == 0)
+		return 0;
+
+	size_t count;
+	size_t new_blocks = 0;
+	size_t usable_size = ALIGN16(size);
+
+	if (size <= SLAB_MAX_SIZE) {
+		count = malloc_slots(usable_size, n, ptrs);
+		for (size_t i = 0; i < count; i++)
+			stats_malloc(slab_class_size(slab_class(usable_size)));
+	} else if (size <= HUGE_MAX_SIZE && !is_huge(usable_size, ALIGNMENT)) {
+		count = malloc_regions(usable_size, n, ptrs, &new_blocks);
+		for (size_t i = 0; i < count; i++)
+			stats_malloc(PTR2REGION(ptrs[i])->size);
+		for (size_t i = 0; i < new_blocks; i++)
+			stats_block();
+	} else {  // each huge region is a mapping of its own anyway
+		for (count = 0; count < n; count++) {
+			if (!(ptrs[count] = allocate(size, ALIGNMENT, false)))
+				break;
+		}
+	}
+	if (count < n)
+		errno = ENOMEM;
+
+	for (size_t i = 0; i < count; i++)
+		TRACE(TRACE_MALLOC, ptrs[i], NULL, size);
+	return count;
+}
+
+// frees the n pointers of ptrs, keeping the lock of an arena set while
+// the pointers belong to it, so freeing memory of the same set takes
+// its lock once. Regions go straight back to their arena, where they
+// are coalesced, instead of to the thread cache.
+void
+free_batch(void **ptrs, size_t n)
+{
+	arena_set_t *locked = NULL;
+
+	for (size_t i = 0; i < n; i++) {
+		void *ptr = ptrs[i];
+		if (!ptr)
+			continue;
+
+		struct block *block = get_block(ptr);
+		if (!block)  // not memory of the library
+			continue;
+
+		struct region *region = NULL;
+		size_t size;
+		if (block->kind == SLAB_BLOCK) {
+			struct slab *slab = block->memory;
+			if (tcache_holds_slot(slab->class, ptr))
+				continue;
+			size = slab->slot_size;
+		} else {
+			region = get_block_region(block, ptr);
+			if (!region || region->free || region->cached)
+				continue;
+			size = region->size;
+		}
+
+		// Only the first trace and count of a thread may allocate,
+		// and they are made before it takes any lock
+		TRACE(TRACE_FREE, ptr, NULL, 0);
+		stats_free(size);  // updates statistics
+
+		if (block->kind == HUGE_BLOCK) {
+			delete_huge_region(region);
+			continue;
+		}
+
+		arena_set_t *set = get_arena_set(block->arena);
+		if (set != locked) {
+			if (locked)
+				unlock_arena_set(locked);
+			locked = lock_arena_set_of(block->arena);
+		}
+		if (region)
+			release_region(region);
+		else
+			slab_free(block->memory, ptr);
+	}
+
+	if (locked)
+		unlock_arena_set(locked);
+}
+
 void
 get_stats(struct malloc_stats *stats)
 {
-	stats->mallocs = amount_of_mallocs;
-	stats->frees = amount_of_frees;
-	stats->requested_memory = requested_memory;
-	stats->blocks = amount_of_blocks;
+	stats_collect(stats->classes, &stats->blocks);
+	stats->arenas_count = collect_arena_stats(stats->arenas, &stats->huge);
+
+	// Huge regions are only counted by their class
+	struct malloc_class_stats *huge = &stats->classes[STATS_HUGE_CLASS];
+	stats->huge.regions = huge->mallocs - huge->frees;
+	stats->huge.allocated = huge->allocated;
+
+	stats->mallocs = 0;
+	stats->frees = 0;
+	stats->requested_memory = 0;
+	for (size_t i = 0; i < STATS_CLASSES; i++) {
+		stats->mallocs += stats->classes[i].mallocs;
+		stats->frees += stats->classes[i].frees;
+		stats->requested_memory += stats->classes[i].allocated;
+	}
+
+	stats->mapped = stats->huge.mapped;
+	stats->resident = stats->huge.resident;
+	stats->huge_pages = stats->huge.huge_pages;
+	for (size_t i = 0; i < stats->arenas_count; i++) {
+		stats->mapped += stats->arenas[i].mapped;
+		stats->resident += stats->arenas[i].resident;
+		stats->huge_pages += stats->arenas[i].huge_pages;
+	}
+}
+
+struct mallinfo2
+mallinfo2(void)
+{
+	struct malloc_stats stats;
+	struct mallinfo2 info = { 0 };
+
+	get_stats(&stats);
+	for (size_t i = 0; i < stats.arenas_count; i++) {
+		struct malloc_arena_stats *arena = &stats.arenas[i];
+		info.arena += arena->mapped;
+		info.ordblks += arena->free_regions;
+		info.uordblks += arena->allocated;
+		info.fordblks += arena->free;
+		info.keepcost += arena->retained;
+	}
+	info.hblks = stats.huge.blocks;
+	info.hblkhd = stats.huge.mapped;
+	return info;
+}
+
+static const char *const arena_kinds[ARENA_KINDS] = { "small", "medium", "large" };
+
+static void
+print_arena_stats(FILE *stream,
+                  const char *name,
+                  size_t nr,
+                  struct malloc_arena_stats *stats)
+{
+	fprintf(stream,
+	        "<%s nr=\"%zu\" blocks=\"%lu\" retained=\"%lu\" "
+	        "regions=\"%lu\" free_regions=\"%lu\" allocated=\"%lu\" "
+	        "free=\"%lu\" mapped=\"%lu\" resident=\"%lu\" "
+	        "huge_pages=\"%lu\" mmaps=\"%lu\" munmaps=\"%lu\"/>\n",
+	        name,
+	        nr,
+	        stats->blocks,
+	        stats->retained,
+	        stats->regions,
+	        stats->free_regions,
+	        stats->allocated,
+	        stats->free,
+	        stats->mapped,
+	        stats->resident,
+	        stats->huge_pages,
+	        stats->mmaps,
+	        stats->munmaps);
+}
+
+// Writes the statistics as XML, like glibc's malloc_info: every arena
+// that mapped a block, huge blocks, every size class that was used and
+// the totals. Options must be 0.
+int
+malloc_info(int options, FILE *stream)
+{
+	if (options != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	// Read before writing, since the stream may allocate
+	struct malloc_stats stats_buffer;
+	struct malloc_stats *stats = &stats_buffer;
+	get_stats(stats);
+
+	fprintf(stream, "<malloc version=\"1\">\n");
+	for (size_t i = 0; i < stats->arenas_count; i++) {
+		if (stats->arenas[i].mmaps > 0)
+			print_arena_stats(stream,
+			                  arena_kinds[i % ARENA_KINDS],
+			                  i / ARENA_KINDS,
+			                  &stats->arenas[i]);
+	}
+	print_arena_stats(stream, "huge", 0, &stats->huge);
+
+	for (size_t i = 0; i < STATS_CLASSES; i++) {
+		struct malloc_class_stats *class = &stats->classes[i];
+		if (class->mallocs > 0)
+			fprintf(stream,
+			        "<class nr=\"%zu\" size=\"%zu\" mallocs=\"%lu\" "
+			        "frees=\"%lu\" allocated=\"%lu\"/>\n",
+			        i,
+			        class->size,
+			        class->mallocs,
+			        class->frees,
+			        class->allocated);
+	}
+	fprintf(stream,
+	        "<total mallocs=\"%lu\" frees=\"%lu\" allocated=\"%lu\" "
+	        "blocks=\"%lu\" mapped=\"%lu\" resident=\"%lu\" "
+	        "huge_pages=\"%lu\"/>\n",
+	        stats->mallocs,
+	        stats->frees,
+	        stats->requested_memory,
+	        stats->blocks,
+	        stats->mapped,
+	        stats->resident,
+	        stats->huge_pages);
+	fprintf(stream, "</malloc>\n");
+	return 0;
 }
@@ -1,23 +1,75 @@
 #ifndef _MALLOC_H_
 #define _MALLOC_H_
 
+#include <stdio.h>
+
 #include "block.h"
+#include "stats.h"
 
+// Allocations are counted by their usable size, and memory moved by
+// realloc counts as a free and a malloc
 struct malloc_stats {
-	int mallocs;
-	int frees;
-	int requested_memory;
-	int blocks;
+	uint64_t mallocs;
+	uint64_t frees;
+	uint64_t requested_memory;  // bytes in use
+	uint64_t blocks;            // created for allocations
+	uint64_t mapped;            // bytes
+	uint64_t resident;
+	uint64_t huge_pages;  // bytes (see HUGE_PAGES)
+	size_t arenas_count;
+	struct malloc_arena_stats arenas[MAX_ARENAS];
+	struct malloc_arena_stats huge;
+	struct malloc_class_stats classes[STATS_CLASSES];
+};
+
+// Same layout as the one of glibc's <malloc.h>
+struct mallinfo2 {
+	size_t arena;     // bytes mapped for arenas
+	size_t ordblks;   // free regions and slots
+	size_t smblks;    // unused
+	size_t hblks;     // huge blocks
+	size_t hblkhd;    // bytes mapped for huge blocks
+	size_t usmblks;   // unused
+	size_t fsmblks;   // unused
+	size_t uordblks;  // bytes in use in arenas
+	size_t fordblks;  // bytes free in arenas
+	size_t keepcost;  // bytes of retained blocks
 };
 
 void *malloc(size_t size);
 
 void free(void *ptr);
 
+void free_sized(void *ptr, size_t size);
+
+void free_aligned_sized(void *ptr, size_t alignment, size_t size);
+
+size_t malloc_usable_size(void *ptr);
+
 void *calloc(size_t nmemb, size_t size);
 
 void *realloc(void *ptr, size_t size);
 
+void *reallocarray(void *ptr, size_t nmemb, size_t size);
+
+int posix_memalign(void **memptr, size_t alignment, size_t size);
+
+void *aligned_alloc(size_t alignment, size_t size);
+
+void *memalign(size_t alignment, size_t size);
+
+void *valloc(size_t size);
+
+void *pvalloc(size_t size);
+
+size_t malloc_batch(size_t size, size_t n, void **ptrs);
+
+void free_batch(void **ptrs, size_t n);
+
 void get_stats(struct malloc_stats *stats);
 
+struct mallinfo2 mallinfo2(void);
+
+int malloc_info(int options, FILE *stream);
+
 #endif  // _MALLOC_H_
@@ -0,0 +1,337 @@
+// Replays a trace recorded with MALLOC_TRACE_FILE (see trace.h) against
+// the allocator of the process. Run it as is to replay it on the C
+// library's malloc, or with LD_PRELOAD=./libmalloc-STRATEGY.so to replay
+// it on the library (see make replay).
+//
+//     ./malloc.replay NAME TRACE
+//
+// Records are replayed in timestamp order from a single thread. Frees
+// and reallocs of objects the trace never allocated (like the ones a
+// forked child inherits from its parent) are skipped.
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define PAGE 4096
+
+// Objects live in an open addressing table keyed by their trace id,
+// which is a pointer aligned to 16 bytes, so 1 can mark removed entries
+#define EMPTY_ID 0
+#define REMOVED_ID 1
+
+struct object {
+	uint64_t id;
+	void *ptr;
+	size_t size;
+};
+
+struct table {
+	struct object *objects;
+	size_t mask;
+};
+
+struct result {
+	size_t ops;
+	size_t skipped;
+	uint64_t elapsed;
+	size_t live_bytes;
+	size_t peak_live_bytes;
+};
+
+/// Utils ///
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static long
+peak_rss_kb(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+// maps memory already faulted in, so it's not counted in the peak RSS
+// of the replay
+static void *
+map_memory(size_t size)
+{
+	void *memory = mmap(NULL,
+	                    size,
+	                    PROT_READ | PROT_WRITE,
+	                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+	                    -1,
+	                    0);
+	return memory == MAP_FAILED ? NULL : memory;
+}
+
+// writes a byte of every page, like the traced program would
+static void
+touch(char *ptr, size_t size)
+{
+	for (size_t offset = 0; offset < size; offset += PAGE)
+		ptr[offset] = 1;
+	ptr[size - 1] = 1;
+}
+
+/// Trace ///
+
+// maps the records of the trace privately, so they can be sorted
+static struct trace_record *
+load_trace(const char *path, size_t *count)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(struct trace_record)) {
+		close(fd);
+		return NULL;
+	}
+
+	void *records =
+	        mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (records == MAP_FAILED)
+		return NULL;
+
+	*count = st.st_size / sizeof(struct trace_record);
+	return records;
+}
+
+static bool
+record_before(struct trace_record *a, struct trace_record *b)
+{
+	return a->timestamp < b->timestamp ||
+	       (a->timestamp == b->timestamp && a->thread < b->thread);
+}
+
+static void
+sift_down(struct trace_record *records, size_t root, size_t count)
+{
+	for (size_t child; (child = 2 * root + 1) < count; root = child) {
+		if (child + 1 < count &&
+		    record_before(&records[child], &records[child + 1]))
+			child++;
+		if (!record_before(&records[root], &records[child]))
+			return;
+
+		struct trace_record tmp = records[root];
+		records[root] = records[child];
+		records[child] = tmp;
+	}
+}
+
+// Every thread writes its buffer when it fills up, so the file is only
+// ordered per thread. Heapsort sorts it in place without allocating.
+static void
+sort_trace(struct trace_record *records, size_t count)
+{
+	for (size_t i = count / 2; i-- > 0;)
+		sift_down(records, i, count);
+
+	for (size_t end = count; end-- > 1;) {
+		struct trace_record tmp = records[0];
+		records[0] = records[end];
+		records[end] = tmp;
+		sift_down(records, 0, end);
+	}
+}
+
+/// Objects ///
+
+// sized for twice the records, so it's never more than half full
+// even counting removed entries
+static bool
+init_table(struct table *table, size_t count)
+{
+	size_t capacity = 16;
+	while (capacity < 2 * count)
+		capacity *= 2;
+
+	table->objects = map_memory(capacity * sizeof(struct object));
+	table->mask = capacity - 1;
+	return table->objects != NULL;
+}
+
+static struct object *
+find_object(struct table *table, uint64_t id)
+{
+	size_t i = (id >> 4) * 0x9e3779b97f4a7c15ULL;
+
+	for (;; i++) {
+		struct object *object = &table->objects[i & table->mask];
+		if (object->id == id)
+			return object;
+		if (object->id == EMPTY_ID)
+			return NULL;
+	}
+}
+
+static void
+add_object(struct table *table, uint64_t id, void *ptr, size_t size)
+{
+	size_t i = (id >> 4) * 0x9e3779b97f4a7c15ULL;
+
+	for (;; i++) {
+		struct object *object = &table->objects[i & table->mask];
+		if (object->id == EMPTY_ID || object->id == REMOVED_ID) {
+			object->id = id;
+			object->ptr = ptr;
+			object->size = size;
+			return;
+		}
+	}
+}
+
+static void
+remove_object(struct object *object)
+{
+	object->id = REMOVED_ID;
+}
+
+/// Replay ///
+
+static void
+add_live_bytes(struct result *result, long size)
+{
+	result->live_bytes += size;
+	if (result->live_bytes > result->peak_live_bytes)
+		result->peak_live_bytes = result->live_bytes;
+}
+
+static void
+replay_free(struct result *result, struct object *object)
+{
+	free(object->ptr);
+	add_live_bytes(result, -(long) object->size);
+	remove_object(object);
+}
+
+static bool
+replay_record(struct table *table,
+              struct result *result,
+              struct trace_record *record)
+{
+	struct object *object;
+	void *ptr;
+
+	switch (record->op) {
+	case TRACE_MALLOC:
+		// the free of an object may be recorded after a thread
+		// got its pointer again
+		if ((object = find_object(table, record->id)))
+			replay_free(result, object);
+
+		ptr = malloc(record->size);
+		if (!ptr)
+			return false;
+		touch(ptr, record->size);
+		add_live_bytes(result, record->size);
+		add_object(table, record->id, ptr, record->size);
+		return true;
+
+	case TRACE_FREE:
+		if (!(object = find_object(table, record->id)))
+			break;
+		replay_free(result, object);
+		return true;
+
+	case TRACE_REALLOC:
+		if (!(object = find_object(table, record->old_id)))
+			break;
+		ptr = realloc(object->ptr, record->size);
+		if (!ptr)
+			return false;
+		touch(ptr, record->size);
+		add_live_bytes(result, (long) record->size - (long) object->size);
+		remove_object(object);
+
+		if ((object = find_object(table, record->id)))
+			replay_free(result, object);
+		add_object(table, record->id, ptr, record->size);
+		return true;
+	}
+
+	result->skipped++;
+	return true;
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s NAME TRACE\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	size_t count;
+	struct trace_record *records = load_trace(argv[2], &count);
+	if (!records) {
+		fprintf(stderr, "%s: can't load trace %s\n", argv[0], argv[2]);
+		return EXIT_FAILURE;
+	}
+	sort_trace(records, count);
+
+	struct table table;
+	if (!init_table(&table, count)) {
+		fprintf(stderr, "%s: out of memory\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	struct result result = { 0 };
+	long base_rss_kb = peak_rss_kb();
+
+	uint64_t start = now_ns();
+	for (size_t i = 0; i < count; i++) {
+		if (!replay_record(&table, &result, &records[i])) {
+			fprintf(stderr,
+			        "%s: allocation of %lu bytes failed\n",
+			        argv[0],
+			        (unsigned long) records[i].size);
+			return EXIT_FAILURE;
+		}
+		result.ops++;
+	}
+	result.elapsed = now_ns() - start;
+
+	long rss_kb = peak_rss_kb() - base_rss_kb;
+	size_t replayed = result.ops - result.skipped;
+
+	printf("%-10s %10s %10s %8s %12s %6s\n",
+	       "allocator",
+	       "ops",
+	       "skipped",
+	       "ns/op",
+	       "peak RSS KB",
+	       "frag");
+	printf("%-10s %10zu %10zu %8.1f %12ld %6.2f\n",
+	       argv[1],
+	       replayed,
+	       result.skipped,
+	       replayed ? (double) result.elapsed / replayed : 0,
+	       rss_kb,
+	       result.peak_live_bytes ? rss_kb * 1024.0 / result.peak_live_bytes
+	                              : 0);
+	return EXIT_SUCCESS;
+}
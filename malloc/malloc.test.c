@@ -1,23 +1,32 @@
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <pthread.h>
 
 #include "testlib.h"
 #include "malloc.h"
+#include "pagemap.h"
+#include "slab.h"
+#include "tcache.h"
+#include "tunables.h"
 
 // TEST UTILS //
 
+#define UNMAPPABLE_SIZE ((size_t) 1 << 62)
+
+
 int count_regions(struct region *block);
 
 int
 count_regions(struct region *block)
 {
 	int regions = 1;
-	struct region *next_region = block->next;
+	struct region *next_region = region_next(block);
 	while (next_region != NULL) {
 		regions++;
-		next_region = next_region->next;
+		next_region = region_next(next_region);
 	}
 	return regions;
 }
@@ -67,13 +76,18 @@ correct_amount_of_requested_memory_after_successful_malloc(void)
 {
 	struct malloc_stats stats;
 	char *var = malloc(100);
-	free(var);
 
 	get_stats(&stats);
 
 	ASSERT_TRUE("TEST 4: amount of requested memory after successful "
-	            "malloc(100) is 100",
-	            stats.requested_memory == 100);
+	            "malloc(100) is 112 (aligned to 16 bytes)",
+	            stats.requested_memory == 112);
+
+	free(var);
+	get_stats(&stats);
+
+	ASSERT_TRUE("TEST 4: amount of requested memory after freeing it is 0",
+	            stats.requested_memory == 0);
 }
 
 static void
@@ -93,12 +107,12 @@ string_in_successful_malloc_is_correct(void)
 static void
 multiple_mallocs_generate_correct_amount_of_regions(void)
 {
-	void *region1 = malloc(100);
-	void *region2 = malloc(100);
-	void *region3 = malloc(100);
-	void *region4 = malloc(100);
-	void *region5 = malloc(100);
-	void *region6 = malloc(100);
+	void *region1 = malloc(300);
+	void *region2 = malloc(300);
+	void *region3 = malloc(300);
+	void *region4 = malloc(300);
+	void *region5 = malloc(300);
+	void *region6 = malloc(300);
 
 	ASSERT_TRUE(
 	        "TEST 6: multiple mallocs generate correct amount of regions",
@@ -222,9 +236,9 @@ realloc_of_bigger_size_coalesces_right_region(void)
 	struct region *region5 = PTR2REGION(var5);
 
 	ASSERT_TRUE("TEST 12: realloc of bigger size coalesces right region",
-	            count_regions(region1) == 5 && region5->size == 3500 &&
-	                    region5->free == false && region5->next->size == 2500 &&
-	                    region5->next->free == true);
+	            count_regions(region1) == 5 && region5->size == 3504 &&
+	                    region5->free == false && region_next(region5)->size == 2512 &&
+	                    region_next(region5)->free == true);
 
 	free(var1);
 	free(var4);
@@ -244,9 +258,9 @@ realloc_of_bigger_size_coalesces_left_region(void)
 	struct region *region5 = PTR2REGION(var5);
 
 	ASSERT_TRUE("TEST 13: realloc of bigger size coalesces left region",
-	            count_regions(region1) == 5 && region5->size == 3500 &&
-	                    region5->free == false && region5->next->size == 2500 &&
-	                    region5->next->free == true);
+	            count_regions(region1) == 5 && region5->size == 3504 &&
+	                    region5->free == false && region_next(region5)->size == 2512 &&
+	                    region_next(region5)->free == true);
 
 	free(var1);
 	free(var4);
@@ -311,11 +325,11 @@ realloc_of_smaller_size_shrinks_region(void)
 	struct region *region2 = PTR2REGION(var2);
 
 	ASSERT_TRUE("TEST 16: realloc of smaller size shrinks region",
-	            region2->size == 500 && region1 == region2);
+	            region2->size == 512 && region1 == region2);
 	ASSERT_TRUE("TEST 17: realloc of smaller size reuses the unused space",
 	            count_regions(region2) == 2 &&
-	                    region2->next->size ==
-	                            SMALL_BLOCK - 2 * REGION_HEADER_SIZE - 500);
+	                    region_next(region2)->size ==
+	                            SMALL_BLOCK - 2 * REGION_HEADER_SIZE - 512);
 
 	free(var2);
 }
@@ -330,8 +344,8 @@ realloc_of_smaller_size_doesnt_split_if_theres_not_enough_space(void)
 	ASSERT_TRUE("TEST 18: realloc of smaller size doesn't split if there's "
 	            "not enough space",
 	            count_regions(region2) == 2 &&
-	                    region2->next->size ==
-	                            SMALL_BLOCK - 2 * REGION_HEADER_SIZE - 1000);
+	                    region_next(region2)->size ==
+	                            SMALL_BLOCK - 2 * REGION_HEADER_SIZE - 1008);
 
 	free(var2);
 }
@@ -348,15 +362,510 @@ realloc_of_same_size_returns_same_pointer(void)
 	free(var1);
 }
 
+#define THREADS 4
+#define THREAD_ROUNDS 20000
+#define THREAD_SLOTS 32
+
+// mallocs, fills and frees random sizes, checking nobody else wrote them
+static void *
+malloc_free_random_sizes(void *arg)
+{
+	unsigned int seed = (unsigned long) arg;
+	unsigned char *slots[THREAD_SLOTS] = { NULL };
+	size_t sizes[THREAD_SLOTS] = { 0 };
+	bool intact = true;
+
+	for (int i = 0; i < THREAD_ROUNDS; i++) {
+		int slot = rand_r(&seed) % THREAD_SLOTS;
+		if (slots[slot]) {
+			for (size_t j = 0; j < sizes[slot]; j++) {
+				if (slots[slot][j] != (unsigned char) slot)
+					intact = false;
+			}
+			free(slots[slot]);
+		}
+		sizes[slot] = 1 + rand_r(&seed) % 2000;
+		slots[slot] = malloc(sizes[slot]);
+		memset(slots[slot], slot, sizes[slot]);
+	}
+	for (int i = 0; i < THREAD_SLOTS; i++) {
+		free(slots[i]);
+	}
+	return (void *) intact;
+}
+
+static void
+concurrent_mallocs_and_frees_dont_overlap(void)
+{
+	struct malloc_stats stats;
+	pthread_t threads[THREADS];
+	bool intact = true;
+
+	for (long i = 0; i < THREADS; i++) {
+		pthread_create(&threads[i], NULL, malloc_free_random_sizes, (void *) i);
+	}
+	for (int i = 0; i < THREADS; i++) {
+		void *result;
+		pthread_join(threads[i], &result);
+		intact = intact && result;
+	}
+
+	get_stats(&stats);
+
+	ASSERT_TRUE("TEST 41: concurrent mallocs and frees don't overlap",
+	            intact);
+	// libc may keep a few allocations of its own for each thread
+	ASSERT_TRUE("TEST 41: every concurrent malloc and free is counted",
+	            stats.mallocs >= THREADS * THREAD_ROUNDS &&
+	                    stats.frees >= THREADS * THREAD_ROUNDS);
+}
+
+static void *
+malloc_and_free_small_regions(void *arg)
+{
+	void **vars = arg;
+	vars[0] = malloc(500);  // Keeps the block alive
+	vars[1] = malloc(500);
+	free(vars[1]);
+	return NULL;
+}
+
+static void
+thread_cache_is_flushed_when_thread_exits(void)
+{
+	pthread_t thread;
+	void *vars[2];
+
+	pthread_create(&thread, NULL, malloc_and_free_small_regions, vars);
+	pthread_join(thread, NULL);
+	void *var1 = vars[0];
+	struct region *region2 = PTR2REGION(vars[1]);
+
+	ASSERT_TRUE("TEST 42: thread cache is given back to the arena when "
+	            "the thread exits",
+	            region2->cached == false && region2->free == true);
+
+	free(var1);
+}
+
+static void
+tiny_mallocs_are_served_from_slab_slots_without_header(void)
+{
+	char *var1 = malloc(16);
+	char *var2 = malloc(16);
+	char *var3 = malloc(100);
+
+	ASSERT_TRUE("TEST 45: tiny mallocs are served from a slab",
+	            get_slab(var1) != NULL && get_slab(var3) != NULL);
+	ASSERT_TRUE("TEST 45: consecutive tiny mallocs have no header between "
+	            "them",
+	            var2 - var1 == 16);
+	ASSERT_TRUE("TEST 45: each size is served from the slab of its class",
+	            get_slab(var3)->slot_size == 112 &&
+	                    get_slab(var1) != get_slab(var3));
+
+	free(var2);
+	void *var4 = malloc(10);
+
+	ASSERT_TRUE("TEST 45: freed slot is reused by the next tiny malloc",
+	            var4 == var2);
+
+	free(var1);
+	free(var3);
+	free(var4);
+}
+
+static void
+realloc_of_tiny_malloc_keeps_slot_while_it_fits(void)
+{
+	char *var1 = malloc(20);
+	strcpy(var1, "FISOP slab");
+	char *var2 = realloc(var1, 30);
+	char *var3 = realloc(var2, 1000);
+
+	ASSERT_TRUE("TEST 46: realloc of tiny malloc keeps the slot while it "
+	            "fits",
+	            var1 == var2);
+	ASSERT_TRUE("TEST 46: realloc of tiny malloc moves the contents when "
+	            "it doesn't fit",
+	            get_slab(var3) == NULL && strcmp(var3, "FISOP slab") == 0);
+
+	free(var3);
+}
+
+static void
+malloc_bigger_than_large_block_maps_a_region_of_its_own(void)
+{
+	struct malloc_stats stats;
+	size_t size = 3 * LARGE_BLOCK;
+	char *var = malloc(size);
+
+	get_stats(&stats);
+
+	ASSERT_TRUE("TEST 48: malloc bigger than a large block returns "
+	            "writable memory",
+	            var != NULL && (var[0] = 'a') && (var[size - 1] = 'z'));
+	ASSERT_TRUE("TEST 48: malloc bigger than a large block maps exactly "
+	            "the pages it needs",
+	            get_huge_region(var) == PTR2REGION(var) &&
+	                    PTR2REGION(var)->size + REGION_HEADER_SIZE ==
+	                            size + PAGE_SIZE && stats.blocks == 1);
+
+	free(var);
+	get_stats(&stats);
+
+	ASSERT_TRUE("TEST 48: free of a huge region unmaps it",
+	            stats.huge.blocks == 0 && stats.huge.munmaps == 1);
+}
+
+
+static void
+realloc_of_huge_region_remaps_its_pages(void)
+{
+	struct malloc_stats stats;
+	char *var1 = malloc(2 * LARGE_BLOCK);
+	var1[0] = 'a';
+	char *var2 = realloc(var1, LARGE_BLOCK + 1);
+
+	ASSERT_TRUE("TEST 49: realloc of huge region to a smaller huge size "
+	            "keeps the mapping",
+	            var2 == var1);
+
+	char *var3 = realloc(var2, 3 * LARGE_BLOCK);
+	get_stats(&stats);
+
+	ASSERT_TRUE("TEST 49: realloc of huge region to a bigger size remaps "
+	            "the contents",
+	            var3 != NULL && var3[0] == 'a' &&
+	                    get_huge_region(var3) == PTR2REGION(var3) &&
+	                    PTR2REGION(var3)->size >= 3 * LARGE_BLOCK);
+	ASSERT_TRUE("TEST 49: realloc of huge region to a bigger size returns "
+	            "writable memory",
+	            (var3[3 * LARGE_BLOCK - 1] = 'z') && stats.huge.blocks == 1);
+
+
+	char *var4 = realloc(var3, 1000);
+
+	ASSERT_TRUE("TEST 49: realloc of huge region to a small size moves "
+	            "it to an arena",
+	            get_huge_region(var4) == NULL && var4[0] == 'a');
+
+	free(var4);
+}
+
+static void
+malloc_returns_pointers_aligned_to_16_bytes(void)
+{
+	size_t sizes[] = { 1, 24, 100, 300, 1000, 3000, 100000, 2 * LARGE_BLOCK };
+	bool aligned = true;
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		char *var1 = malloc(sizes[i]);
+		char *var2 = malloc(sizes[i]);
+		if ((uintptr_t) var1 % 16 != 0 || (uintptr_t) var2 % 16 != 0)
+			aligned = false;
+		free(var1);
+		free(var2);
+	}
+
+	ASSERT_TRUE("TEST 53: malloc returns pointers aligned to 16 bytes",
+	            aligned);
+}
+
+static void
+aligned_allocations_return_aligned_pointers(void)
+{
+	struct malloc_stats stats;
+	void *var1 = NULL;
+	int result = posix_memalign(&var1, 64, 100);
+	char *var2 = aligned_alloc(4096, 3000);
+	char *var3 = memalign(256, 20000);
+	char *var4 = valloc(100);
+	char *var5 = pvalloc(5000);
+	char *var6 = aligned_alloc(1UL << 22, 2 * LARGE_BLOCK);
+
+	ASSERT_TRUE("TEST 54: posix_memalign returns a pointer aligned to 64",
+	            result == 0 && var1 && (uintptr_t) var1 % 64 == 0);
+	ASSERT_TRUE("TEST 54: aligned_alloc and memalign return aligned "
+	            "pointers",
+	            var2 && (uintptr_t) var2 % 4096 == 0 && var3 &&
+	                    (uintptr_t) var3 % 256 == 0);
+	ASSERT_TRUE("TEST 54: valloc and pvalloc return page aligned pointers",
+	            var4 && (uintptr_t) var4 % PAGE_SIZE == 0 && var5 &&
+	                    (uintptr_t) var5 % PAGE_SIZE == 0 &&
+	                    PTR2REGION(var5)->size >= 2 * PAGE_SIZE);
+	ASSERT_TRUE("TEST 54: aligned allocation bigger than a large block has "
+	            "a mapping of its own",
+	            var6 && (uintptr_t) var6 % (1UL << 22) == 0 &&
+	                    get_huge_region(var6) == PTR2REGION(var6) &&
+	                    (var6[2 * LARGE_BLOCK - 1] = 'z'));
+
+	free(var1);
+	free(var2);
+	free(var3);
+	free(var4);
+	free(var5);
+	free(var6);
+	get_stats(&stats);
+
+	ASSERT_TRUE("TEST 54: aligned huge region is unmapped by free",
+	            stats.huge.blocks == 0 && stats.huge.munmaps == 1);
+
+}
+
+static void
+malloc_usable_size_returns_the_size_the_pointer_holds(void)
+{
+	char *var1 = malloc(100);
+	char *var2 = malloc(3000);
+	char *var3 = malloc(2 * LARGE_BLOCK);
+	int local;
+
+	ASSERT_TRUE("TEST 57: malloc_usable_size of a slab slot is its slot "
+	            "size",
+	            malloc_usable_size(var1) == get_slab(var1)->slot_size);
+	ASSERT_TRUE("TEST 57: malloc_usable_size of a region is its size",
+	            malloc_usable_size(var2) == 3008 &&
+	                    malloc_usable_size(var3) == PTR2REGION(var3)->size);
+	ASSERT_TRUE("TEST 57: malloc_usable_size of memory out of the library "
+	            "is 0",
+	            malloc_usable_size(&local) == 0 &&
+	                    malloc_usable_size(NULL) == 0);
+
+	free(var1);
+	free(var2);
+	free(var3);
+}
+
+static void
+sized_frees_give_back_memory_without_looking_it_up(void)
+{
+	struct malloc_stats stats;
+	char *var1 = malloc(100);
+	char *var2 = malloc(3000);
+	char *var3 = malloc(2 * LARGE_BLOCK);
+	char *var4 = aligned_alloc(1024, 2000);
+
+	free_sized(var1, 100);
+	free_sized(var2, 3000);
+	free_sized(var3, 2 * LARGE_BLOCK);
+	free_aligned_sized(var4, 1024, 2000);
+
+	get_stats(&stats);
+
+	ASSERT_TRUE("TEST 58: sized frees give back slots, regions and huge "
+	            "regions",
+	            stats.frees == 4 && stats.requested_memory == 0 &&
+	                    stats.huge.blocks == 0);
+
+	char *var5 = malloc(100);
+
+	ASSERT_TRUE("TEST 58: slot given back with free_sized is reused",
+	            var5 == var1);
+
+	char *var6 = malloc(3000);
+	char *var7 = realloc(var6, 200);
+	get_stats(&stats);
+
+	ASSERT_TRUE("TEST 58: realloc of a region to a slab size moves it to a "
+	            "slot",
+	            get_slab(var7) != NULL && stats.frees == 5 &&
+	                    stats.requested_memory ==
+	                            malloc_usable_size(var5) +
+	                                    malloc_usable_size(var7));
+
+
+	free_sized(var5, 100);
+	free_sized(var7, 200);
+
+}
+
+static void
+stats_are_broken_down_per_size_class_and_arena(void)
+{
+	struct malloc_stats stats;
+	char *var1 = malloc(100);
+	char *var2 = malloc(3000);
+	char *var3 = malloc(2 * LARGE_BLOCK);
+	size_t size2 = malloc_usable_size(var2);
+	size_t size3 = malloc_usable_size(var3);
+
+	get_stats(&stats);
+
+	ASSERT_TRUE("TEST 60: allocations are counted in the class of their "
+	            "size",
+	            stats.classes[stats_class(112)].allocated == 112 &&
+	                    stats.classes[stats_class(size2)].allocated == size2 &&
+	                    stats.classes[STATS_HUGE_CLASS].mallocs == 1 &&
+	                    stats.requested_memory == 112 + size2 + size3);
+	// The slab and the region are in the same small arena
+	struct malloc_arena_stats *arena = &stats.arenas[PTR2REGION(var2)->arena];
+
+	ASSERT_TRUE("TEST 60: arenas count their blocks and allocated bytes",
+	            arena->allocated == 112 + size2 && arena->mmaps == 2 &&
+	                    stats.huge.blocks == 1 && stats.huge.allocated == size3 &&
+	                    stats.mapped >= stats.resident);
+
+	struct mallinfo2 info = mallinfo2();
+
+	ASSERT_TRUE("TEST 60: mallinfo2 counts arenas and huge blocks apart",
+	            info.uordblks == 112 + size2 && info.hblks == 1 &&
+	                    info.hblkhd > size3 && info.arena > info.uordblks);
+
+	free(var1);
+	free(var2);
+	free(var3);
+	get_stats(&stats);
+
+	ASSERT_TRUE("TEST 60: freed memory isn't counted anymore",
+	            stats.requested_memory == 0 && stats.huge.mapped == 0 &&
+	                    stats.huge.munmaps == 1);
+}
+
+static void *
+malloc_and_exit(void *arg)
+{
+	(void) arg;
+	return malloc(100);
+}
+
+static void
+stats_of_exited_threads_are_kept(void)
+{
+	struct malloc_stats stats;
+	pthread_t thread;
+	void *var;
+
+	// pthread allocates too, but none of its allocations is a slot of 112
+	struct malloc_class_stats *class = &stats.classes[stats_class(112)];
+	pthread_create(&thread, NULL, malloc_and_exit, NULL);
+	pthread_join(thread, &var);
+	get_stats(&stats);
+
+	ASSERT_TRUE("TEST 61: statistics of exited threads are kept",
+	            class->mallocs == 1 && class->allocated == 112);
+
+	free(var);
+	get_stats(&stats);
+
+	ASSERT_TRUE("TEST 61: memory of an exited thread freed by another one",
+	            class->frees == 1 && class->allocated == 0);
+}
+
+static void
+malloc_info_writes_statistics_as_xml(void)
+{
+	char buffer[16384] = { 0 };
+	char *var = malloc(3000);
+	FILE *stream = fmemopen(buffer, sizeof(buffer) - 1, "w");
+
+	int result = malloc_info(0, stream);
+	fclose(stream);
+
+	ASSERT_TRUE("TEST 62: malloc_info writes the statistics as XML",
+	            result == 0 && strstr(buffer, "<malloc version=\"1\">") &&
+	                    strstr(buffer, "<small nr=") &&
+	                    strstr(buffer, "allocated=\"3008\"") &&
+	                    strstr(buffer, "</malloc>"));
+	ASSERT_TRUE("TEST 62: malloc_info fails with options other than 0",
+	            malloc_info(1, stdout) == -1 && errno == EINVAL);
+
+	free(var);
+}
+
+static void
+malloc_batch_carves_consecutive_regions(void)
+{
+	struct malloc_stats stats;
+	void *ptrs[16];
+
+	size_t count = malloc_batch(1000, 16, ptrs);
+	bool consecutive = true;
+	for (size_t i = 1; i < count; i++)
+		consecutive = consecutive && region_next(PTR2REGION(ptrs[i - 1])) ==
+		                                     PTR2REGION(ptrs[i]);
+	get_stats(&stats);
+
+	ASSERT_TRUE("TEST 66: malloc_batch allocates every pointer",
+	            count == 16 && stats.mallocs == 16 &&
+	                    stats.requested_memory == 16 * 1008);
+	ASSERT_TRUE("TEST 66: malloc_batch carves the regions one after the "
+	            "other",
+	            consecutive);
+
+	struct malloc_arena_stats *arena = &stats.arenas[get_arena(1008)->id];
+	free_batch(ptrs, 16);
+	get_stats(&stats);
+
+	// The empty block is retained as a single free region, or unmapped
+	ASSERT_TRUE("TEST 66: free_batch frees and coalesces every region",
+	            stats.frees == 16 && stats.requested_memory == 0 &&
+	                    arena->allocated == 0 &&
+	                    arena->free_regions == arena->blocks);
+
+
+	void *more[32];  // more than a small block holds
+	count = malloc_batch(1000, 32, more);
+	bool own_arena = true;
+	for (size_t i = 0; i < count; i++)
+		own_arena = own_arena &&
+		            get_block(more[i])->arena == get_arena(1008);
+
+	ASSERT_TRUE("TEST 66: malloc_batch takes the regions from the arena "
+	            "of their size",
+	            count == 32 && own_arena);
+
+	free_batch(more, 32);
+}
+
+static void
+malloc_batch_of_small_size_uses_slab_slots(void)
+{
+	struct malloc_stats stats;
+	void *ptrs[100];
+
+	size_t count = malloc_batch(32, 100, ptrs);
+	bool slots = true;
+	for (size_t i = 0; i < count; i++)
+		slots = slots && get_slab(ptrs[i]) != NULL &&
+		        malloc_usable_size(ptrs[i]) == 32;
+	get_stats(&stats);
+
+	ASSERT_TRUE("TEST 67: malloc_batch of a small size takes slab slots",
+	            count == 100 && slots && stats.mallocs == 100);
+
+	free_batch(ptrs, 100);
+	get_stats(&stats);
+
+	ASSERT_TRUE("TEST 67: free_batch gives the slots back",
+	            stats.frees == 100 && stats.requested_memory == 0);
+
+	void *var1 = malloc(32);
+	uintptr_t address1 = (uintptr_t) var1;
+	free(var1);  // kept in the thread cache
+	free_batch(&var1, 1);
+	void *var2 = malloc(32);
+	void *var3 = malloc(32);
+	get_stats(&stats);
+
+	ASSERT_TRUE("TEST 67: free_batch skips a slot already in the thread "
+	            "cache",
+	            stats.frees == 101 && (uintptr_t) var2 == address1 &&
+	                    var3 != var2);
+
+	free(var2);
+	free(var3);
+}
+
 // ERROR TESTS //
 
 static void
-malloc_bigger_than_biggest_block_returns_null_pointer(void)
+malloc_bigger_than_address_space_returns_null_pointer(void)
 {
-	char *var = malloc(LARGE_BLOCK + 1);
+	char *var = malloc(UNMAPPABLE_SIZE);
 
-	ASSERT_TRUE("TEST 20: malloc bigger than biggest block returns null "
-	            "pointer",
+	ASSERT_TRUE("TEST 20: malloc bigger than the address space returns "
+	            "null pointer",
 	            var == NULL);
 
 	free(var);
@@ -374,15 +883,15 @@ malloc_of_size_zero_returns_null_pointer(void)
 }
 
 static void
-amount_of_mallocs_after_malloc_bigger_than_biggest_block_is_zero(void)
+amount_of_mallocs_after_malloc_bigger_than_address_space_is_zero(void)
 {
 	struct malloc_stats stats;
-	char *var = malloc(LARGE_BLOCK + 1);
+	char *var = malloc(UNMAPPABLE_SIZE);
 
 	get_stats(&stats);
 
 	ASSERT_TRUE("TEST 22: amount of mallocs after malloc bigger than "
-	            "biggest block is zero",
+	            "the address space is zero",
 	            stats.mallocs == 0);
 
 	free(var);
@@ -392,7 +901,7 @@ static void
 amount_of_frees_after_unsuccessful_malloc_is_zero(void)
 {
 	struct malloc_stats stats;
-	char *var = malloc(LARGE_BLOCK + 1);
+	char *var = malloc(UNMAPPABLE_SIZE);
 	free(var);
 
 	get_stats(&stats);
@@ -405,7 +914,7 @@ static void
 amount_of_requested_memory_after_unsuccessful_malloc_is_zero(void)
 {
 	struct malloc_stats stats;
-	char *var = malloc(LARGE_BLOCK + 1);
+	char *var = malloc(UNMAPPABLE_SIZE);
 	free(var);
 
 	get_stats(&stats);
@@ -439,6 +948,43 @@ calloc_of_nmemb_or_size_zero_returns_null_pointer(void)
 	        var1 == NULL && var2 == NULL);
 }
 
+static void
+aligned_allocation_with_invalid_alignment_fails(void)
+{
+	void *var1 = NULL;
+	int result1 = posix_memalign(&var1, 24, 100);
+	int result2 = posix_memalign(&var1, 4, 100);
+	void *var2 = aligned_alloc(48, 100);
+
+	ASSERT_TRUE("TEST 55: posix_memalign of an alignment that isn't a "
+	            "power of two multiple of a pointer fails with EINVAL",
+	            result1 == EINVAL && result2 == EINVAL && var1 == NULL);
+	ASSERT_TRUE("TEST 55: aligned_alloc of an alignment that isn't a power "
+	            "of two returns null pointer",
+	            var2 == NULL && errno == EINVAL);
+}
+
+static void
+reallocarray_that_overflows_returns_null_pointer(void)
+{
+	volatile size_t nmemb = SIZE_MAX / 2;  // not known when compiling
+	char *volatile var1 = malloc(3000);  // kept by the failed reallocarray
+	char *var2 = reallocarray(var1, nmemb, 4);
+
+	ASSERT_TRUE("TEST 59: reallocarray that overflows returns null pointer "
+	            "and keeps the memory",
+	            var2 == NULL && errno == ENOMEM &&
+	                    PTR2REGION(var1)->free == false);
+
+	char *var3 = reallocarray(var1, 100, 40);
+
+	ASSERT_TRUE("TEST 59: reallocarray of nmemb elements of size bytes "
+	            "holds them",
+	            var3 != NULL && malloc_usable_size(var3) >= 4000);
+
+	free(var3);
+}
+
 /*
 static void
 freeing_pointer_that_wasnt_malloced_does_nothing(void)
@@ -544,7 +1090,7 @@ splitting_block_with_size_of_full_block_doesnt_split(void)
 	            "region after trying to split",
 	            count_regions(test_block) == 1);
 	ASSERT_TRUE("TEST 32: first region of the block has no next",
-	            test_block->next == NULL);
+	            region_next(test_block) == NULL);
 
 	free(test_block);
 }
@@ -603,9 +1149,9 @@ successful_split_with_multiple_regions(void)
 	            expected_size == count_regions(test_block));
 
 	struct region *current = test_block;
-	struct region *next = current->next;
+	struct region *next = region_next(current);
 	while (next) {
-		next = current->next;
+		next = region_next(current);
 		free(current);
 		current = next;
 	}
@@ -643,7 +1189,7 @@ successful_coalesce_with_3_regions(void)
 	ASSERT_TRUE("\nTEST 36: successfully splitted into 3 regions",
 	            3 == count_regions(test_block));
 
-	free_region1->free = true;
+	set_region_free(free_region1, true);
 	coalescing(free_region2);
 
 	ASSERT_TRUE("TEST 36: successfully coalesce 3 regions into 1",
@@ -671,8 +1217,8 @@ successful_coalesce_with_multiple_regions(void)
 	ASSERT_TRUE("\nTEST 37: successfully splitted into 5 regions",
 	            5 == count_regions(test_block));
 
-	free_region1->free = true;
-	free_region3->free = true;
+	set_region_free(free_region1, true);
+	set_region_free(free_region3, true);
 
 	coalescing(free_region2);
 	ASSERT_TRUE("TEST 37: successfully coalesced regions 1, 2, 3",
@@ -686,6 +1232,560 @@ successful_coalesce_with_multiple_regions(void)
 	free(test_block);
 }
 
+static void
+find_free_region_returns_freed_region(void)
+{
+	void *var1 = malloc(1500);
+	void *var2 = malloc(1500);
+	void *var3 = malloc(1500);
+	uintptr_t address2 = (uintptr_t) var2;
+	free(var2);
+	struct region *free_region = find_free_region(1500);
+
+	ASSERT_TRUE("\nTEST 38: find free region returns the freed region "
+	            "from its bin",
+	            free_region != NULL &&
+	                    (uintptr_t) REGION2PTR(free_region) == address2);
+
+	ASSERT_TRUE("TEST 38: the found region is taken out of its bin",
+	            free_region->free == false && free_region->in_bin == false);
+
+	free(var1);
+	free(var3);
+}
+
+static void
+bin_order_decides_which_free_region_is_found(void)
+{
+	void *var1 = malloc(1500);
+	void *var2 = malloc(1500);
+	void *var3 = malloc(1500);
+	void *var4 = malloc(1500);
+#ifdef ADDRESS_ORDER
+	uintptr_t expected = (uintptr_t) var1;
+#else
+	uintptr_t expected = (uintptr_t) var3;
+#endif
+	free(var1);
+	free(var3);
+	uintptr_t found = (uintptr_t) REGION2PTR(find_free_region(1500));
+
+#ifdef ADDRESS_ORDER
+	ASSERT_TRUE("\nTEST 64: address ordered bin returns its lowest region",
+	            found == expected);
+#else
+	ASSERT_TRUE("\nTEST 64: LIFO bin returns the last freed region",
+	            found == expected);
+
+#endif
+
+
+	free(var2);
+	free(var4);
+}
+
+static void
+find_free_region_skips_smaller_regions_of_the_same_bin(void)
+{
+	void *var1 = malloc(1100);
+	void *var2 = malloc(1000);
+	void *var3 = malloc(1200);
+	void *var4 = malloc(1000);
+	uintptr_t address3 = (uintptr_t) var3;
+	free(var1);
+	free(var3);
+
+	ASSERT_TRUE("\nTEST 39: regions of 1100 and 1200 bytes share a bin",
+	            size_class(1100) == size_class(1200));
+	ASSERT_TRUE("TEST 39: find free region skips the region that doesn't "
+	            "hold the size",
+	            (uintptr_t) REGION2PTR(find_free_region(1150)) == address3);
+
+
+	free(var2);
+	free(var4);
+}
+
+static void
+malloc_conf_sets_the_tunables(void)
+{
+	struct tunables parsed = tunables;
+	bool valid = parse_tunables("strategy:best_fit,large_block:64M,"
+	                            "tcache_depth:8,decay_ms:0",
+	                            &parsed);
+
+	ASSERT_TRUE("\nTEST 70: MALLOC_CONF pairs set the tunables",
+	            valid && parsed.strategy == STRATEGY_BEST_FIT &&
+	                    parsed.block_sizes[2] == (64UL << 20) &&
+	                    parsed.tcache_depth == 8 && parsed.decay_ms == 0);
+
+	parsed = tunables;
+	valid = parse_tunables("strategy:worst_fit,tcache_depth:1000,"
+	                       "retained_blocks:2,medium_block:8k",
+	                       &parsed);
+
+	ASSERT_TRUE("TEST 70: invalid pairs and block sizes are ignored",
+	            !valid && parsed.strategy == tunables.strategy &&
+	                    parsed.tcache_depth == tunables.tcache_depth &&
+	                    parsed.retained_blocks == 2 &&
+	                    parsed.block_sizes[1] == tunables.block_sizes[1]);
+}
+
+static void
+strategy_is_chosen_at_runtime(void)
+{
+	enum strategy strategy = tunables.strategy;
+	void *var1 = malloc(1200);
+	void *var2 = malloc(1000);
+	void *var3 = malloc(1104);
+	void *var4 = malloc(1000);
+	void *var5 = malloc(1200);
+	void *var6 = malloc(1000);
+	uintptr_t address1 = (uintptr_t) var1;
+	uintptr_t address3 = (uintptr_t) var3;
+	uintptr_t address5 = (uintptr_t) var5;
+	free(var1);
+	free(var3);
+	free(var5);
+
+	tunables.strategy = STRATEGY_FIRST_FIT;
+	struct region *first = find_free_region(1104);
+	uintptr_t first_address = (uintptr_t) REGION2PTR(first);
+	release_region(first);
+	tunables.strategy = STRATEGY_BEST_FIT;
+	struct region *best = find_free_region(1104);
+	uintptr_t best_address = (uintptr_t) REGION2PTR(best);
+	release_region(best);
+	tunables.strategy = strategy;
+
+	ASSERT_TRUE("\nTEST 71: first fit takes the first region that holds "
+	            "the size",
+	            first_address == address1 || first_address == address5);
+	ASSERT_TRUE("TEST 71: best fit takes the smallest one",
+	            best_address == address3);
+
+
+	free(var2);
+	free(var4);
+	free(var6);
+}
+
+static void
+next_fit_resumes_and_good_fit_stops_early(void)
+{
+	enum strategy strategy = tunables.strategy;
+	void *var1 = malloc(1264);
+	void *var2 = malloc(1000);
+	void *var3 = malloc(1104);
+	void *var4 = malloc(1000);
+	void *var5 = malloc(1264);
+	void *var6 = malloc(1000);
+	uintptr_t address1 = (uintptr_t) var1;
+	uintptr_t address5 = (uintptr_t) var5;
+	free(var1);
+	free(var3);
+	free(var5);
+
+	tunables.strategy = STRATEGY_NEXT_FIT;
+	struct region *next1 = find_free_region(1104);
+	release_region(next1);
+	struct region *next2 = find_free_region(1104);
+	release_region(next2);
+	tunables.strategy = STRATEGY_GOOD_FIT;
+	struct region *good = find_free_region(1104);
+	uintptr_t good_address = (uintptr_t) REGION2PTR(good);
+	size_t good_size = good ? good->size : 0;
+	release_region(good);
+	tunables.strategy = strategy;
+
+	ASSERT_TRUE("\nTEST 72: next fit resumes after the region it took",
+	            next1 != NULL && next2 != NULL && next1 != next2);
+	ASSERT_TRUE("TEST 72: good fit skips regions that waste too much",
+	            good_address != address1 && good_address != address5 &&
+	                    good_size >= 1104 &&
+	                    good_size - 1104 <=
+	                            1104 * tunables.good_fit_tolerance / 100);
+
+
+	free(var2);
+	free(var4);
+	free(var6);
+}
+
+static void
+size_classes_grow_with_size(void)
+{
+	bool increasing = true;
+	for (size_t size = 1; size < LARGE_BLOCK; size = size * 5 / 4 + 1) {
+		if (size_class(size * 5 / 4 + 1) < size_class(size))
+			increasing = false;
+	}
+
+	ASSERT_TRUE("\nTEST 40: sizes under the minimum share the first bin",
+	            size_class(1) == 0 && size_class(255) == 0);
+	ASSERT_TRUE("TEST 40: bins never decrease with the size", increasing);
+	ASSERT_TRUE("TEST 40: each power of two is split in several bins",
+	            size_class(256) < size_class(320) &&
+	                    size_class(320) < size_class(512));
+}
+
+static void
+freed_small_region_is_kept_in_thread_cache(void)
+{
+	void *var1 = malloc(500);  // keeps the block mapped
+	void *var2 = malloc(500);
+	uintptr_t address2 = (uintptr_t) var2;
+	free(var2);
+	struct region *region2 = region_next(PTR2REGION(var1));
+
+	ASSERT_TRUE("\nTEST 43: freed small region is kept in the thread cache",
+	            (uintptr_t) REGION2PTR(region2) == address2 &&
+	                    region2->cached == true && region2->free == false);
+
+	void *var3 = malloc(500);
+
+	ASSERT_TRUE("TEST 43: malloc of the same size reuses the cached region",
+	            (uintptr_t) var3 == address2 &&
+	                    PTR2REGION(var3)->cached == false);
+
+	free(var1);
+	free(var3);
+}
+
+
+static bool
+single_arena_set(void)
+{
+	struct malloc_stats stats;
+	get_stats(&stats);
+	return stats.arenas_count == ARENA_KINDS;
+}
+
+static void *
+malloc_medium_region(void *arg)
+{
+	(void) arg;
+	return malloc(3000);
+}
+
+static void
+malloc_uses_sibling_arena_set_when_its_own_is_locked(void)
+{
+	// With a single arena set (make ARENAS=1) the thread would wait for
+	// the lock held here forever
+	if (single_arena_set())
+		return;
+
+	arena_set_t *set = lock_arena_set();
+	pthread_t thread;
+	void *var;
+
+	pthread_create(&thread, NULL, malloc_medium_region, NULL);
+	pthread_join(thread, &var);
+	unlock_arena_set(set);
+
+	ASSERT_TRUE("\nTEST 44: malloc uses a sibling arena set when its own "
+	            "is locked",
+	            var != NULL && get_region_arena_set(PTR2REGION(var)) != set);
+
+	free(var);
+}
+
+static void *
+free_region_of_another_thread(void *arg)
+{
+	free(arg);
+	return NULL;
+}
+
+static void
+free_of_another_thread_is_pushed_without_locking(void)
+{
+	// The thread registers its caches, which may allocate, and with a
+	// single arena set it would wait for the lock held here
+	if (single_arena_set())
+		return;
+
+	struct malloc_stats stats;
+	char *var = malloc(2000);
+	char *pin = malloc(2000);  // keeps the block mapped
+	struct region *region = PTR2REGION(var);
+	arena_t *arena = get_region_arena(region);
+	arena_set_t *set = lock_arena_set();
+	pthread_t thread;
+
+	pthread_create(&thread, NULL, free_region_of_another_thread, var);
+	pthread_join(thread, NULL);
+
+	ASSERT_TRUE("\nTEST 69: free of another thread is pushed while the "
+	            "set is locked",
+	            set->remote_frees == var && region->cached == true &&
+	                    region->free == false);
+	unlock_arena_set(set);
+
+	set = lock_arena_set_of(arena);
+	unlock_arena_set(set);
+	get_stats(&stats);
+
+	ASSERT_TRUE("TEST 69: the next lock of its set releases the region",
+	            set->remote_frees == NULL &&
+	                    stats.arenas[arena->id].allocated ==
+	                            malloc_usable_size(pin));
+
+	free(pin);
+}
+
+
+static void
+slab_slots_are_tracked_in_its_bitmap(void)
+{
+	void *slot1 = slab_malloc(100);
+	struct slab *slab = get_slab(slot1);
+
+	ASSERT_TRUE("\nTEST 47: slab slot of 100 bytes has 112 bytes",
+	            slab != NULL && slab->slot_size == 112 &&
+	                    slab->class == slab_class(100));
+	ASSERT_TRUE("TEST 47: first slot is marked as used in the bitmap",
+	            slab->used == 1 && (slab->free_slots[0] & 1) == 0);
+
+	void *slot2 = slab_malloc(100);
+	slab_free(slab, slot1);
+
+	ASSERT_TRUE("TEST 47: freed slot is marked as free in the bitmap",
+	            slab->used == 1 && (slab->free_slots[0] & 1) == 1);
+	ASSERT_TRUE("TEST 47: freed slot is the next one to be used",
+	            slab_malloc(100) == slot1);
+
+	slab_free(slab, slot1);
+	slab_free(slab, slot2);
+
+	ASSERT_TRUE("TEST 47: the only slab with free slots is kept when empty",
+	            get_slab(slot1) == slab && slab->used == 0);
+}
+
+static void
+block_of_any_address_of_a_region_is_found(void)
+{
+	char *var = malloc(3000);
+	struct region *region = PTR2REGION(var);
+	struct block *block = get_block(var);
+	int local;
+
+	ASSERT_TRUE("\nTEST 50: block of a region is found by its address",
+	            block != NULL && block->kind == REGION_BLOCK &&
+	                    block->arena == get_region_arena(region));
+	ASSERT_TRUE("TEST 50: block is found from any address inside it",
+	            get_block(var + 2999) == block &&
+	                    get_block((char *) block->memory + block->size - 1) ==
+	                            block);
+	ASSERT_TRUE("TEST 50: addresses out of the library have no block",
+	            get_block(&local) == NULL);
+
+	free(var);
+}
+
+static void
+empty_block_is_retained_and_reused(void)
+{
+	// Without retained blocks (make RETAIN=0) empty blocks are unmapped
+	if (tunables.retained_blocks == 0)
+		return;
+
+	struct malloc_stats stats;
+	char *var1 = malloc(3000);
+	struct block *block = get_block(var1);
+	arena_t *arena = block->arena;
+
+	free(var1);
+	get_stats(&stats);
+
+	ASSERT_TRUE("\nTEST 51: empty block is retained by its arena instead "
+	            "of being unmapped",
+	            arena->retained == block && arena->retained_count == 1 &&
+	                    stats.arenas[arena->id].retained == block->size);
+
+
+	char *var2 = malloc(3000);
+
+	ASSERT_TRUE("TEST 51: retained block is reused by the next new block",
+	            get_block(var2) == block && arena->retained == NULL &&
+	                    arena->blocks == block);
+
+	free(var2);
+}
+
+static void
+free_region_pages_are_purged_after_decay(void)
+{
+	// Without a decay (make DECAY=0) pages are purged when they're freed
+	if (tunables.decay_ms == 0)
+		return;
+
+	struct malloc_stats stats;
+	char *var1 = malloc(100000);
+	char *var2 = malloc(100000);  // keeps the block mapped
+	uintptr_t address1 = (uintptr_t) var1;
+	arena_t *arena = get_region_arena(PTR2REGION(var1));
+
+	memset(var1, 'a', 100000);
+	free(var1);
+	struct region *region1 = region_prev(PTR2REGION(var2));
+	get_stats(&stats);
+	uint64_t resident = stats.arenas[arena->id].resident;
+
+	ASSERT_TRUE("\nTEST 52: free region keeps its pages before the decay",
+	            region1 != NULL &&
+	                    (uintptr_t) REGION2PTR(region1) == address1 &&
+	                    region1->free == true && region1->purged == false);
+
+	purge_arena(arena, clock_ms() + tunables.decay_ms);
+	get_stats(&stats);
+
+	ASSERT_TRUE("TEST 52: free region gives back its interior pages after "
+	            "the decay",
+	            region1->purged == true &&
+	                    stats.arenas[arena->id].resident < resident);
+	ASSERT_TRUE("TEST 52: purged region stays in its bin",
+	            region1->in_bin == true &&
+	                    find_free_region(100000) == region1);
+
+	free(var2);
+}
+
+static void
+calloc_doesnt_clear_the_pages_of_a_purged_region(void)
+{
+	char *var1 = malloc(100000);
+	char *var2 = malloc(100000);  // keeps the block mapped
+	arena_t *arena = get_region_arena(PTR2REGION(var1));
+	struct region *rest = region_next(PTR2REGION(var2));
+
+	memset(var1, 'a', 100000);
+	free(var1);
+	purge_arena(arena, clock_ms() + tunables.decay_ms);
+	char *var3 = calloc(1, 100000);
+
+	unsigned char resident;
+	mincore((void *) PAGE_ROUND((uintptr_t) var3 + 50000), PAGE_SIZE, &resident);
+	// Pages purged with MADV_FREE may keep their contents, so calloc
+	// clears them
+	ASSERT_TRUE("\nTEST 65: calloc reuses the purged region without "
+	            "touching its interior pages",
+	            var3 == var1 && ((resident & 1) == 0 || !PURGE_ZEROES));
+
+
+	bool zero = true;
+	for (size_t i = 0; i < 100000; i++)
+		zero = zero && var3[i] == 0;
+	ASSERT_TRUE("TEST 65: calloc clears the pages that weren't purged", zero);
+
+	// Pages never written are zero with any PURGE_ADVICE
+	ASSERT_TRUE("TEST 65: the rest of a new block is fresh",
+	            rest != NULL && rest->free == true && rest->purged == true &&
+	                    rest->fresh == true);
+	char *var4 = calloc(1, 200000);
+	mincore((void *) PAGE_ROUND((uintptr_t) var4 + 100000),
+	        PAGE_SIZE,
+	        &resident);
+	ASSERT_TRUE("TEST 65: calloc doesn't touch the pages of a fresh region",
+	            PTR2REGION(var4) == rest && (resident & 1) == 0 &&
+	                    rest->fresh == false);
+
+	free(var2);
+	free(var3);
+	free(var4);
+}
+
+
+static void
+aligned_region_gives_back_the_space_before_it(void)
+{
+	char *var1 = malloc(2000);
+	char *var2 = memalign(1024, 2000);
+	struct region *region2 = PTR2REGION(var2);
+
+	ASSERT_TRUE("\nTEST 56: aligned region is split from a free region",
+	            (uintptr_t) var2 % 1024 == 0 && region2->size == 2000 &&
+	                    region2->free == false);
+	struct region *prev = region_prev(region2);
+	ASSERT_TRUE("TEST 56: space before the aligned region is a free region",
+	            prev && prev != PTR2REGION(var1) && prev->free == true &&
+	                    prev->in_bin == true && prev->size >= REGION_MIN_SIZE);
+
+	free(var2);
+
+	ASSERT_TRUE("TEST 56: freed aligned region coalesces with the space "
+	            "before it",
+	            region_next(PTR2REGION(var1))->free == true &&
+	                    region_next(region_next(PTR2REGION(var1))) == NULL);
+
+	free(var1);
+}
+
+static void
+free_region_is_found_from_the_next_by_its_footer(void)
+{
+	char *var1 = malloc(2000);
+	char *var2 = malloc(2000);
+	char *var3 = malloc(2000);
+	uintptr_t address2 = (uintptr_t) var2;
+	struct region *region1 = PTR2REGION(var1);
+	struct region *region3 = PTR2REGION(var3);
+
+	ASSERT_TRUE("\nTEST 63: used region isn't found from the next one",
+	            region_next(region1) == PTR2REGION(var2) &&
+	                    PTR2REGION(var2)->prev_free == false &&
+	                    region_prev(PTR2REGION(var2)) == NULL);
+
+	free(var2);  // too big for the thread cache
+	struct region *region2 = region_prev(region3);
+
+	ASSERT_TRUE("TEST 63: free region keeps its size in its footer",
+	            region3->prev_free == true && region2 != NULL &&
+	                    (uintptr_t) REGION2PTR(region2) == address2 &&
+	                    region2->free == true &&
+	                    *REGION_FOOTER(region2) == 2000 &&
+	                    region_next(region1) == region2);
+
+
+	free(var1);
+	free(var3);
+}
+
+static void
+only_large_blocks_use_huge_pages(void)
+{
+	struct malloc_stats stats;
+	char *var1 = malloc(100000);   // a medium block
+	char *var2 = malloc(4 << 20);  // a large block
+	struct block *block1 = get_block(var1);
+	struct block *block2 = get_block(var2);
+	get_stats(&stats);
+
+	ASSERT_TRUE("\nTEST 68: medium blocks are too small for huge pages",
+	            block1->huge_pages == false);
+	ASSERT_TRUE("TEST 68: large blocks use huge pages only if enabled",
+	            (HUGE_PAGES != HUGE_PAGES_OFF || block2->huge_pages == false) &&
+	                    stats.huge_pages ==
+	                            (block2->huge_pages ? LARGE_BLOCK : 0));
+
+	// var3 keeps the region of var2 apart from the rest of the block
+	char *var3 = malloc(4 << 20);
+	arena_t *arena = block2->arena;
+	memset(var2, 'a', 4 << 20);
+	free(var2);
+	struct region *region = region_prev(PTR2REGION(var3));
+	purge_arena(arena, clock_ms() + tunables.decay_ms);
+
+	ASSERT_TRUE("TEST 68: regions of MAP_HUGETLB blocks keep their pages",
+	            region != NULL && region->free == true &&
+	                    region->purged == !block2->hugetlb);
+
+	free(var1);
+	free(var3);
+}
+
+
 int
 main(void)
 {
@@ -708,15 +1808,32 @@ main(void)
 	run_test(realloc_of_smaller_size_shrinks_region);
 	run_test(realloc_of_smaller_size_doesnt_split_if_theres_not_enough_space);
 	run_test(realloc_of_same_size_returns_same_pointer);
+	run_test(concurrent_mallocs_and_frees_dont_overlap);
+	run_test(thread_cache_is_flushed_when_thread_exits);
+	run_test(tiny_mallocs_are_served_from_slab_slots_without_header);
+	run_test(realloc_of_tiny_malloc_keeps_slot_while_it_fits);
+	run_test(malloc_bigger_than_large_block_maps_a_region_of_its_own);
+	run_test(realloc_of_huge_region_remaps_its_pages);
+	run_test(malloc_returns_pointers_aligned_to_16_bytes);
+	run_test(aligned_allocations_return_aligned_pointers);
+	run_test(malloc_usable_size_returns_the_size_the_pointer_holds);
+	run_test(sized_frees_give_back_memory_without_looking_it_up);
+	run_test(stats_are_broken_down_per_size_class_and_arena);
+	run_test(stats_of_exited_threads_are_kept);
+	run_test(malloc_info_writes_statistics_as_xml);
+	run_test(malloc_batch_carves_consecutive_regions);
+	run_test(malloc_batch_of_small_size_uses_slab_slots);
 
 	printfmt("\nERROR TESTS:\n");
-	run_test(malloc_bigger_than_biggest_block_returns_null_pointer);
+	run_test(malloc_bigger_than_address_space_returns_null_pointer);
 	run_test(malloc_of_size_zero_returns_null_pointer);
-	run_test(amount_of_mallocs_after_malloc_bigger_than_biggest_block_is_zero);
+	run_test(amount_of_mallocs_after_malloc_bigger_than_address_space_is_zero);
 	run_test(amount_of_frees_after_unsuccessful_malloc_is_zero);
 	run_test(amount_of_requested_memory_after_unsuccessful_malloc_is_zero);
 	run_test(freeing_null_pointer_does_nothing);
 	run_test(calloc_of_nmemb_or_size_zero_returns_null_pointer);
+	run_test(aligned_allocation_with_invalid_alignment_fails);
+	run_test(reallocarray_that_overflows_returns_null_pointer);
 	// Tests with warnings for using wrong pointers with offset
 	// run_test(freeing_pointer_that_wasnt_malloced_does_nothing);
 	// run_test(realloc_pointer_that_wasnt_malloced_returns_null);
@@ -731,6 +1848,24 @@ main(void)
 	run_test(successful_coalesce_with_2_regions);
 	run_test(successful_coalesce_with_3_regions);
 	run_test(successful_coalesce_with_multiple_regions);
+	run_test(find_free_region_returns_freed_region);
+	run_test(bin_order_decides_which_free_region_is_found);
+	run_test(find_free_region_skips_smaller_regions_of_the_same_bin);
+	run_test(malloc_conf_sets_the_tunables);
+	run_test(strategy_is_chosen_at_runtime);
+	run_test(next_fit_resumes_and_good_fit_stops_early);
+	run_test(size_classes_grow_with_size);
+	run_test(freed_small_region_is_kept_in_thread_cache);
+	run_test(malloc_uses_sibling_arena_set_when_its_own_is_locked);
+	run_test(free_of_another_thread_is_pushed_without_locking);
+	run_test(slab_slots_are_tracked_in_its_bitmap);
+	run_test(block_of_any_address_of_a_region_is_found);
+	run_test(empty_block_is_retained_and_reused);
+	run_test(free_region_pages_are_purged_after_decay);
+	run_test(calloc_doesnt_clear_the_pages_of_a_purged_region);
+	run_test(aligned_region_gives_back_the_space_before_it);
+	run_test(free_region_is_found_from_the_next_by_its_footer);
+	run_test(only_large_blocks_use_huge_pages);
 
 	return 0;
 }
@@ -0,0 +1,184 @@
+// Replaceable global operators new and delete on top of the library,
+// built into libmalloc++.so so libmalloc.so stays free of libstdc++.
+
+// The sized deletes pass the size along, so the memory is given back
+// with free_sized without looking it up in the page map nor validating
+// its header.
+
+#include <cstdlib>
+#include <new>
+
+// Not declared by every C library yet (see malloc.h)
+extern "C" {
+void free_sized(void *ptr, std::size_t size) noexcept;
+void free_aligned_sized(void *ptr, std::size_t alignment, std::size_t size) noexcept;
+}
+
+namespace {
+
+// malloc(0) returns a null pointer, new has to return a unique one
+std::size_t
+new_size(std::size_t size)
+{
+	return size ? size : 1;
+}
+
+// allocates like the standard operator new: calls the new handler until
+// there is memory, or throws std::bad_alloc if there is none
+void *
+allocate(std::size_t size, std::size_t alignment)
+{
+	size = new_size(size);
+	for (;;) {
+		void *ptr = alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__
+		                    ? std::malloc(size)
+		                    : std::aligned_alloc(alignment, size);
+		if (ptr)
+			return ptr;
+
+		std::new_handler handler = std::get_new_handler();
+		if (!handler)
+			throw std::bad_alloc();
+		handler();
+	}
+}
+
+void *
+allocate_nothrow(std::size_t size, std::size_t alignment) noexcept
+{
+	try {
+		return allocate(size, alignment);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+}  // namespace
+
+/// new ///
+
+void *
+operator new(std::size_t size)
+{
+	return allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *
+operator new[](std::size_t size)
+{
+	return allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *
+operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+	return allocate_nothrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *
+operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+	return allocate_nothrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *
+operator new(std::size_t size, std::align_val_t alignment)
+{
+	return allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void *
+operator new[](std::size_t size, std::align_val_t alignment)
+{
+	return allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void *
+operator new(std::size_t size,
+             std::align_val_t alignment,
+             const std::nothrow_t &) noexcept
+{
+	return allocate_nothrow(size, static_cast<std::size_t>(alignment));
+}
+
+void *
+operator new[](std::size_t size,
+               std::align_val_t alignment,
+               const std::nothrow_t &) noexcept
+{
+	return allocate_nothrow(size, static_cast<std::size_t>(alignment));
+}
+
+/// delete ///
+
+void
+operator delete(void *ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void
+operator delete[](void *ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void
+operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+	std::free(ptr);
+}
+
+void
+operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+	std::free(ptr);
+}
+
+void
+operator delete(void *ptr, std::size_t size) noexcept
+{
+	free_sized(ptr, new_size(size));
+}
+
+void
+operator delete[](void *ptr, std::size_t size) noexcept
+{
+	free_sized(ptr, new_size(size));
+}
+
+void
+operator delete(void *ptr, std::align_val_t) noexcept
+{
+	std::free(ptr);
+}
+
+void
+operator delete[](void *ptr, std::align_val_t) noexcept
+{
+	std::free(ptr);
+}
+
+void
+operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{
+	std::free(ptr);
+}
+
+void
+operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{
+	std::free(ptr);
+}
+
+void
+operator delete(void *ptr, std::size_t size, std::align_val_t alignment) noexcept
+{
+	free_aligned_sized(ptr, static_cast<std::size_t>(alignment), new_size(size));
+}
+
+void
+operator delete[](void *ptr, std::size_t size, std::align_val_t alignment) noexcept
+{
+	free_aligned_sized(ptr, static_cast<std::size_t>(alignment), new_size(size));
+}
@@ -0,0 +1,77 @@
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "pagemap.h"
+
+#define PAGEMAP_NODE_SIZE (PAGEMAP_FANOUT * sizeof(void *))
+#define PAGEMAP_MASK (PAGEMAP_FANOUT - 1)
+
+// Inner nodes and leaves are mapped on demand, so only the address
+// ranges that hold blocks use memory
+static void *pagemap_root[PAGEMAP_FANOUT];
+
+// returns the node in the slot, creating it if asked to.
+// Nodes are never removed, so readers don't need locks.
+static void **
+get_node(void **slot, bool create)
+{
+	void *node = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+	if (node || !create)
+		return node;
+
+	void *new_node = mmap(NULL,
+	                      PAGEMAP_NODE_SIZE,
+	                      PROT_READ | PROT_WRITE,
+	                      MAP_PRIVATE | MAP_ANONYMOUS,
+	                      -1,
+	                      0);
+	if (new_node == MAP_FAILED)
+		return NULL;
+
+	// Another thread may have created it in the meantime
+	if (__atomic_compare_exchange_n(
+	            slot, &node, new_node, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		return new_node;
+	}
+	munmap(new_node, PAGEMAP_NODE_SIZE);
+	return node;
+}
+
+// returns the leaf entry of the page of the address
+static void **
+get_entry(const void *addr, bool create)
+{
+	uintptr_t page = (uintptr_t) addr >> PAGE_SHIFT;
+	if (page >> (PAGEMAP_BITS * PAGEMAP_LEVELS))
+		return NULL;
+
+	void **node = pagemap_root;
+	for (int level = PAGEMAP_LEVELS - 1; level > 0 && node; level--) {
+		size_t index = (page >> (level * PAGEMAP_BITS)) & PAGEMAP_MASK;
+		node = get_node(&node[index], create);
+	}
+	return node ? &node[page & PAGEMAP_MASK] : NULL;
+}
+
+// maps every page of the range to the value,
+// returns false if the map couldn't grow
+bool
+pagemap_set(void *addr, size_t size, void *value)
+{
+	for (size_t offset = 0; offset < size; offset += PAGE_SIZE) {
+		void **entry = get_entry((char *) addr + offset, value != NULL);
+		if (entry)
+			__atomic_store_n(entry, value, __ATOMIC_RELEASE);
+		else if (value)
+			return false;
+	}
+	return true;
+}
+
+// returns the value of the page of the address, or NULL
+void *
+pagemap_get(const void *addr)
+{
+	void **entry = get_entry(addr, false);
+	return entry ? __atomic_load_n(entry, __ATOMIC_ACQUIRE) : NULL;
+}
@@ -0,0 +1,21 @@
+#ifndef _PAGEMAP_H_
+#define _PAGEMAP_H_
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define PAGE_ROUND(s) (((s) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+// The page map is a radix tree of PAGEMAP_LEVELS levels, each one
+// resolving PAGEMAP_BITS bits of the page number of 48 bit addresses
+#define PAGEMAP_BITS 12
+#define PAGEMAP_LEVELS 3
+#define PAGEMAP_FANOUT (1UL << PAGEMAP_BITS)
+
+bool pagemap_set(void *addr, size_t size, void *value);
+
+void *pagemap_get(const void *addr);
+
+#endif  // _PAGEMAP_H_
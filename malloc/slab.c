@@ -0,0 +1,167 @@
+#include <stdint.h>
+
+#include "slab.h"
+
+#define SLOT2PTR(slab, i)                                                      \
+	((char *) (slab) + SLAB_SLOTS_OFFSET + (i) * (slab)->slot_size)
+
+static const unsigned short slot_sizes[SLAB_CLASSES] = {
+	16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256
+};
+
+// returns the class of the smallest slot that holds the size
+size_t
+slab_class(size_t size)
+{
+	if (size <= 128)
+		return size ? (size - 1) / 16 : 0;
+	return 8 + (size - 129) / 32;
+}
+
+size_t
+slab_class_size(size_t class)
+{
+	return slot_sizes[class];
+}
+
+// returns the slab that holds the pointer, or NULL if it's not
+// a slab pointer
+struct slab *
+get_slab(void *ptr)
+{
+	struct block *block = get_block(ptr);
+
+	return block && block->kind == SLAB_BLOCK ? block->memory : NULL;
+}
+
+static void
+push_slab(arena_t *arena, struct slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = arena->slabs[slab->class];
+	if (slab->next)
+		slab->next->prev = slab;
+	arena->slabs[slab->class] = slab;
+}
+
+static void
+remove_slab(arena_t *arena, struct slab *slab)
+{
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		arena->slabs[slab->class] = slab->next;
+	if (slab->next)
+		slab->next->prev = slab->prev;
+}
+
+// moves a slot of the slab between the free and used counts of its arena
+static void
+count_slot(struct slab *slab, bool used)
+{
+	arena_t *arena = slab->arena;
+	if (used) {
+		arena->regions++;
+		arena->free_regions--;
+		arena->allocated += slab->slot_size;
+		arena->free -= slab->slot_size;
+	} else {
+		arena->regions--;
+		arena->free_regions++;
+		arena->allocated -= slab->slot_size;
+		arena->free += slab->slot_size;
+	}
+}
+
+static struct slab *
+create_slab(arena_t *arena, size_t class)
+{
+	struct block *block = map_block(SLAB_BLOCK, SLAB_SIZE, arena);
+	if (!block)
+		return NULL;
+
+	struct slab *slab = block->memory;
+	slab->checksum = SLAB_MAGIC;
+	slab->slot_size = slot_sizes[class];
+	slab->slots = (SLAB_SIZE - SLAB_SLOTS_OFFSET) / slab->slot_size;
+	slab->used = 0;
+	slab->class = class;
+	slab->arena = arena;
+
+	// Every slot starts free
+	for (size_t i = 0; i < slab->slots; i += BINMAP_BITS) {
+		size_t left = slab->slots - i;
+		slab->free_slots[i / BINMAP_BITS] =
+		        left >= BINMAP_BITS ? ~0UL : (1UL << left) - 1;
+	}
+
+	arena->free_regions += slab->slots;
+	arena->free += (size_t) slab->slots * slab->slot_size;
+	push_slab(arena, slab);
+	return slab;
+}
+
+static void
+delete_slab(struct slab *slab)
+{
+	arena_t *arena = slab->arena;
+	arena->free_regions -= slab->slots;
+	arena->free -= (size_t) slab->slots * slab->slot_size;
+	remove_slab(arena, slab);
+	unmap_block(get_block(slab));
+}
+
+// returns a free slot for the size from the small arena
+// of the thread's set, which must be locked
+void *
+slab_malloc(size_t size)
+{
+	arena_t *arena = get_arena(size);
+	size_t class = slab_class(size);
+
+	struct slab *slab = arena->slabs[class];
+	if (!slab) {
+		slab = create_slab(arena, class);
+		if (!slab)
+			return NULL;
+	}
+
+	size_t word = 0;
+	while (!slab->free_slots[word]) {
+		word++;
+	}
+	size_t bit = __builtin_ctzl(slab->free_slots[word]);
+	slab->free_slots[word] &= ~(1UL << bit);
+	count_slot(slab, true);
+
+	if (++slab->used == slab->slots)
+		remove_slab(arena, slab);  // full slabs are only found by address
+
+	return SLOT2PTR(slab, word * BINMAP_BITS + bit);
+}
+
+// gives back the slot of the pointer, the slab's arena set must be locked
+void
+slab_free(struct slab *slab, void *ptr)
+{
+	size_t offset = (uintptr_t) ptr - (uintptr_t) SLOT2PTR(slab, 0);
+	size_t slot = offset / slab->slot_size;
+
+	// Ignore pointers that aren't the start of a used slot
+	if ((uintptr_t) ptr < (uintptr_t) SLOT2PTR(slab, 0) ||
+	    offset % slab->slot_size != 0 || slot >= slab->slots)
+		return;
+	unsigned long mask = 1UL << (slot % BINMAP_BITS);
+	if (slab->free_slots[slot / BINMAP_BITS] & mask)
+		return;
+
+	slab->free_slots[slot / BINMAP_BITS] |= mask;
+	count_slot(slab, false);
+	if (slab->used-- == slab->slots)
+
+		push_slab(slab->arena, slab);
+
+	// Empty slabs are unmapped, unless it's the only one with free slots
+	if (slab->used == 0 && (slab->prev || slab->next))
+		delete_slab(slab);
+}
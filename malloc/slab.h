@@ -0,0 +1,38 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include "block.h"
+
+// A slab is a small block split in slots of a single size, with no
+// header per slot. Its first bytes hold the slab metadata, including a
+// bitmap of the free slots.
+#define SLAB_MAGIC 23072001
+#define SLAB_SIZE SMALL_BLOCK
+#define SLAB_MAX_SIZE REGION_MIN_SIZE
+#define SLAB_MIN_SLOT 16
+#define SLAB_BITMAP_WORDS (SLAB_SIZE / SLAB_MIN_SLOT / BINMAP_BITS)
+#define SLAB_SLOTS_OFFSET (((sizeof(struct slab) - 1) / 16 + 1) * 16)
+
+struct slab {
+	int checksum;
+	unsigned short slot_size;
+	unsigned short slots;
+	unsigned short used;
+	unsigned char class;
+	arena_t *arena;
+	struct slab *next;
+	struct slab *prev;
+	unsigned long free_slots[SLAB_BITMAP_WORDS];
+};
+
+size_t slab_class(size_t size);
+
+size_t slab_class_size(size_t class);
+
+struct slab *get_slab(void *ptr);
+
+void *slab_malloc(size_t size);
+
+void slab_free(struct slab *slab, void *ptr);
+
+#endif  // _SLAB_H_
@@ -0,0 +1,236 @@
+#include "slab.h"
+#include "stats.h"
+#include "tunables.h"
+
+// Every thread counts its own operations in its counters, which only
+// it writes, so counting takes no locks nor atomic read-modify-writes.
+// Reading them adds up the counters of every thread. The ones of exited
+// threads are added to retired_stats, where the frees their last
+// destructors make are counted atomically.
+
+struct counters {
+	uint64_t mallocs;
+	uint64_t frees;
+	uint64_t allocated;
+};
+
+enum stats_state { STATS_UNREGISTERED, STATS_REGISTERED, STATS_EXITED };
+
+struct thread_stats {
+	struct counters classes[STATS_CLASSES];
+	uint64_t blocks;
+	struct thread_stats *next;
+	struct thread_stats *prev;
+	enum stats_state state;
+};
+
+static THREAD_LOCAL struct thread_stats thread_stats;
+static struct thread_stats retired_stats;
+static struct thread_stats *registered_stats;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t stats_key;
+static pthread_once_t stats_key_once = PTHREAD_ONCE_INIT;
+
+// returns the class of the usable size of an allocation
+size_t
+stats_class(size_t size)
+{
+	if (size <= SLAB_MAX_SIZE)
+		return slab_class(size);
+	if (size + REGION_HEADER_SIZE > LARGE_BLOCK_SIZE)
+		return STATS_HUGE_CLASS;
+	return SLAB_CLASSES + size_class(size);
+}
+
+size_t
+stats_class_size(size_t class)
+{
+	if (class < SLAB_CLASSES)
+		return slab_class_size(class);
+	if (class == STATS_HUGE_CLASS)
+		return LARGE_BLOCK_SIZE - REGION_HEADER_SIZE + 1;
+
+	// The inverse of size_class, without the sizes of slab classes
+	size_t bin = class - SLAB_CLASSES;
+	if (bin <= 1)
+		return SLAB_MAX_SIZE + 1;
+	size_t shift = BIN_MIN_SHIFT + ((bin - 1) >> BIN_STEPS_SHIFT);
+	size_t step = (bin - 1) & ((1UL << BIN_STEPS_SHIFT) - 1);
+	return (1UL << shift) + (step << (shift - BIN_STEPS_SHIFT));
+}
+
+static void
+retire_on_thread_exit(void *arg)
+{
+	struct thread_stats *stats = arg;
+
+	pthread_mutex_lock(&stats_lock);
+	for (size_t i = 0; i < STATS_CLASSES; i++) {
+		struct counters *retired = &retired_stats.classes[i];
+		struct counters *class = &stats->classes[i];
+		__atomic_fetch_add(&retired->mallocs, class->mallocs, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&retired->frees, class->frees, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&retired->allocated,
+		                   class->allocated,
+		                   __ATOMIC_RELAXED);
+	}
+	__atomic_fetch_add(&retired_stats.blocks, stats->blocks, __ATOMIC_RELAXED);
+
+	if (stats->prev)
+		stats->prev->next = stats->next;
+	else
+		registered_stats = stats->next;
+	if (stats->next)
+		stats->next->prev = stats->prev;
+	stats->state = STATS_EXITED;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+static void
+create_stats_key(void)
+{
+	pthread_key_create(&stats_key, retire_on_thread_exit);
+}
+
+// the counters are registered so they are read, and retired when the
+// thread exits
+static void
+register_stats(void)
+{
+	// pthread_setspecific may allocate, which must not register it again
+	thread_stats.state = STATS_REGISTERED;
+
+	pthread_mutex_lock(&stats_lock);
+	thread_stats.prev = NULL;
+	thread_stats.next = registered_stats;
+	if (registered_stats)
+		registered_stats->prev = &thread_stats;
+	registered_stats = &thread_stats;
+	pthread_mutex_unlock(&stats_lock);
+
+	pthread_once(&stats_key_once, create_stats_key);
+	pthread_setspecific(stats_key, &thread_stats);
+}
+
+// adds to a counter of the thread, which is read by other threads
+static void
+add(uint64_t *counter, uint64_t n)
+{
+	if (thread_stats.state == STATS_EXITED) {
+		counter = (uint64_t *) ((char *) &retired_stats +
+		                        ((char *) counter - (char *) &thread_stats));
+		__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+		return;
+	}
+	if (thread_stats.state == STATS_UNREGISTERED)
+		register_stats();
+	__atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+// counts an allocation of the usable size
+void
+stats_malloc(size_t size)
+{
+	struct counters *class = &thread_stats.classes[stats_class(size)];
+
+	add(&class->mallocs, 1);
+	add(&class->allocated, size);
+}
+
+// counts a free of an allocation of the usable size
+void
+stats_free(size_t size)
+{
+	struct counters *class = &thread_stats.classes[stats_class(size)];
+
+	add(&class->frees, 1);
+	add(&class->allocated, -size);
+}
+
+// counts an allocation resized in place, which moves to the class of
+// its new size
+void
+stats_resize(size_t old_size, size_t size)
+{
+	if (stats_class(old_size) != stats_class(size)) {
+		stats_free(old_size);
+		stats_malloc(size);
+		return;
+	}
+
+	struct counters *class = &thread_stats.classes[stats_class(size)];
+	add(&class->allocated, size - old_size);
+}
+
+// counts a block created for an allocation
+void
+stats_block(void)
+{
+	add(&thread_stats.blocks, 1);
+}
+
+static void
+add_up(struct malloc_class_stats *classes,
+       uint64_t *blocks,
+       struct thread_stats *stats)
+{
+	for (size_t i = 0; i < STATS_CLASSES; i++) {
+		struct counters *class = &stats->classes[i];
+		classes[i].mallocs +=
+		        __atomic_load_n(&class->mallocs, __ATOMIC_RELAXED);
+		classes[i].frees += __atomic_load_n(&class->frees, __ATOMIC_RELAXED);
+		classes[i].allocated +=
+		        __atomic_load_n(&class->allocated, __ATOMIC_RELAXED);
+	}
+	*blocks += __atomic_load_n(&stats->blocks, __ATOMIC_RELAXED);
+}
+
+// adds up the counters of every thread. Memory freed by another thread
+// than the one that allocated it is taken from that thread's counters,
+// whose sum is still right.
+void
+stats_collect(struct malloc_class_stats *classes, uint64_t *blocks)
+{
+	*blocks = 0;
+	for (size_t i = 0; i < STATS_CLASSES; i++) {
+		classes[i].size = stats_class_size(i);
+		classes[i].mallocs = 0;
+		classes[i].frees = 0;
+		classes[i].allocated = 0;
+	}
+
+	pthread_mutex_lock(&stats_lock);
+	add_up(classes, blocks, &retired_stats);
+	for (struct thread_stats *stats = registered_stats; stats;
+	     stats = stats->next)
+		add_up(classes, blocks, stats);
+	pthread_mutex_unlock(&stats_lock);
+}
+
+/// Fork ///
+
+static void
+prefork(void)
+{
+	pthread_mutex_lock(&stats_lock);
+}
+
+static void
+postfork_parent(void)
+{
+	pthread_mutex_unlock(&stats_lock);
+}
+
+// The counters of the other threads stay in the child, which inherits
+// the memory they count
+static void
+postfork_child(void)
+{
+	pthread_mutex_init(&stats_lock, NULL);
+}
+
+__attribute__((constructor)) static void
+register_fork_handlers(void)
+{
+	pthread_atfork(prefork, postfork_parent, postfork_child);
+}
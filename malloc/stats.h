@@ -0,0 +1,53 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+
+#include "block.h"
+
+// Allocations are counted by the size they get: one class per slab
+// slot size, one per bin of regions and one for huge regions
+#define STATS_CLASSES (SLAB_CLASSES + BIN_COUNT + 1)
+#define STATS_HUGE_CLASS (STATS_CLASSES - 1)
+#define MAX_ARENAS (MAX_ARENA_SETS * ARENA_KINDS)
+
+struct malloc_class_stats {
+	size_t size;  // smallest size of the class
+	uint64_t mallocs;
+	uint64_t frees;
+	uint64_t allocated;  // bytes in use
+};
+
+// Arenas keep running counts of these under the lock of their set.
+// Regions count as free while they are in a bin, so the ones in thread
+// caches are allocated. Pages purged from free regions aren't counted
+// as resident.
+struct malloc_arena_stats {
+	uint64_t blocks;
+	uint64_t retained;  // bytes of the empty blocks kept for reuse
+	uint64_t regions;   // regions and used slab slots
+	uint64_t free_regions;
+	uint64_t allocated;  // bytes
+	uint64_t free;       // bytes
+	uint64_t mmaps;
+	uint64_t munmaps;
+	uint64_t mapped;  // bytes
+	uint64_t resident;
+	uint64_t huge_pages;  // bytes on huge pages or advised to use them
+};
+
+size_t stats_class(size_t size);
+
+size_t stats_class_size(size_t class);
+
+void stats_malloc(size_t size);
+
+void stats_free(size_t size);
+
+void stats_resize(size_t old_size, size_t size);
+
+void stats_block(void);
+
+void stats_collect(struct malloc_class_stats *classes, uint64_t *blocks);
+
+#endif  // _STATS_H_
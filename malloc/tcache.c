@@ -0,0 +1,178 @@
+#include "tcache.h"
+#include "tunables.h"
+
+static THREAD_LOCAL struct tcache tcache;
+
+// Cached slots keep the link to the next one and, to detect double
+// frees without looking through the cache, the address of the cache
+struct cached_slot {
+	void *next;
+	struct tcache *key;
+};
+
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+
+static void
+flush_on_thread_exit(void *arg)
+{
+	(void) arg;
+	tcache_flush();
+	// Frees made by later destructors go straight to the arenas
+	tcache.disabled = true;
+}
+
+static void
+create_tcache_key(void)
+{
+	pthread_key_create(&tcache_key, flush_on_thread_exit);
+}
+
+// the cache is registered so it is flushed when the thread exits
+static void
+register_tcache(void)
+{
+	// pthread_setspecific may allocate, which must not register it again
+	tcache.registered = true;
+	pthread_once(&tcache_key_once, create_tcache_key);
+	pthread_setspecific(tcache_key, &tcache);
+}
+
+static struct region *
+pop_entry(size_t index)
+{
+	struct region *region = tcache.entries[index];
+
+	tcache.entries[index] = REGION2LINKS(region)->next;
+	tcache.count[index]--;
+	region->cached = false;
+
+	return region;
+}
+
+// returns a cached region that holds the size, without touching
+// the arenas
+struct region *
+tcache_get(size_t size)
+{
+	if (size < tunables.region_min_size)
+		size = tunables.region_min_size;
+	if (size > TCACHE_MAX_SIZE)
+		return NULL;
+
+	// Regions of the bin of the size may be a few bytes short,
+	// the ones of the next bin always hold it
+	size_t index = TCACHE_INDEX(size);
+	struct region *region = tcache.entries[index];
+	if (region && region->size >= size)
+		return pop_entry(index);
+
+	if (index + 1 < TCACHE_BINS && tcache.entries[index + 1])
+		return pop_entry(index + 1);
+
+	return NULL;
+}
+
+// keeps an allocated region in the cache of the thread,
+// returns false if it has to be released to its arena
+bool
+tcache_put(struct region *region)
+{
+	if (region->size > TCACHE_MAX_SIZE || tcache.disabled)
+		return false;
+
+	size_t index = TCACHE_INDEX(region->size);
+	if (tcache.count[index] >= tunables.tcache_depth)
+		return false;
+
+	if (!tcache.registered)
+		register_tcache();
+
+	REGION2LINKS(region)->next = tcache.entries[index];
+	tcache.entries[index] = region;
+	tcache.count[index]++;
+	region->cached = true;
+
+	return true;
+}
+
+static void *
+pop_slot(size_t class)
+{
+	struct cached_slot *slot = tcache.slots[class];
+
+	tcache.slots[class] = slot->next;
+	tcache.slot_count[class]--;
+	slot->key = NULL;
+
+	return slot;
+}
+
+// returns a cached slab slot of the class, without touching the arenas
+void *
+tcache_get_slot(size_t class)
+{
+	return tcache.slots[class] ? pop_slot(class) : NULL;
+}
+
+// returns true if the slot of the class is already in the cache of
+// the thread
+bool
+tcache_holds_slot(size_t class, void *ptr)
+{
+	// A slot without the key is surely not cached,
+	// one with the key may also be just user data
+	if (((struct cached_slot *) ptr)->key != &tcache)
+		return false;
+
+	for (void *cached = tcache.slots[class]; cached;
+	     cached = ((struct cached_slot *) cached)->next) {
+		if (cached == ptr)
+			return true;
+	}
+	return false;
+}
+
+// keeps a used slab slot of the class in the cache of the thread,
+// returns false if it has to be given back to its slab
+bool
+tcache_put_slot(size_t class, void *ptr)
+{
+	struct cached_slot *slot = ptr;
+
+	if (tcache.disabled || tcache.slot_count[class] >= tunables.tcache_depth)
+		return false;
+
+	if (!tcache.registered)
+		register_tcache();
+
+	slot->next = tcache.slots[class];
+	slot->key = &tcache;
+	tcache.slots[class] = slot;
+	tcache.slot_count[class]++;
+
+	return true;
+}
+
+// gives back every cached region and slot to its arena
+void
+tcache_flush(void)
+{
+	for (size_t i = 0; i < TCACHE_BINS; i++) {
+		while (tcache.entries[i]) {
+			struct region *region = pop_entry(i);
+			arena_set_t *set = lock_region_arena_set(region);
+			release_region(region);
+			unlock_arena_set(set);
+		}
+	}
+	for (size_t i = 0; i < SLAB_CLASSES; i++) {
+		while (tcache.slots[i]) {
+			void *ptr = pop_slot(i);
+			struct slab *slab = get_slab(ptr);
+			arena_set_t *set = lock_arena_set_of(slab->arena);
+			slab_free(slab, ptr);
+			unlock_arena_set(set);
+		}
+	}
+}
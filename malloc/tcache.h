@@ -0,0 +1,38 @@
+#ifndef _TCACHE_H_
+#define _TCACHE_H_
+
+#include "block.h"
+#include "slab.h"
+
+// Regions up to TCACHE_MAX_SIZE bytes are kept in a per-thread cache
+// when freed, in bins of TCACHE_STEP bytes with up to TCACHE_DEPTH
+// regions each
+#define TCACHE_MAX_SIZE 1024
+#define TCACHE_STEP 16
+#define TCACHE_BINS (TCACHE_MAX_SIZE / TCACHE_STEP + 1)
+#define TCACHE_DEPTH 16
+
+#define TCACHE_INDEX(s) ((s) / TCACHE_STEP)
+
+struct tcache {
+	struct region *entries[TCACHE_BINS];
+	unsigned char count[TCACHE_BINS];
+	void *slots[SLAB_CLASSES];
+	unsigned char slot_count[SLAB_CLASSES];
+	bool registered;
+	bool disabled;
+};
+
+struct region *tcache_get(size_t size);
+
+bool tcache_put(struct region *region);
+
+void *tcache_get_slot(size_t class);
+
+bool tcache_holds_slot(size_t class, void *ptr);
+
+bool tcache_put_slot(size_t class, void *ptr);
+
+void tcache_flush(void);
+
+#endif  // _TCACHE_H_
@@ -10,11 +10,20 @@ void
 run_test(test_case_t test_case)
 {
 	pid_t p;
+	int status;
 
 	if ((p = fork()) == 0) {
 		test_case();
 		exit(EXIT_SUCCESS);
 	}
 
-	assert(wait(NULL) > 0);
+	assert(wait(&status) > 0);
+
+	// A test that crashes can't report its own failure
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+		printfmt("Test ended with status %d: %sFAIL%s\n",
+		         status,
+		         COLOR_RED,
+		         COLOR_RESET);
 }
+
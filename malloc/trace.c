@@ -0,0 +1,163 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "block.h"
+#include "trace.h"
+
+struct trace_buffer {
+	struct trace_record records[TRACE_BUFFER_RECORDS];
+	size_t count;
+	uint64_t last_timestamp;
+	uint32_t thread;
+	bool registered;
+};
+
+enum trace_state trace_state = TRACE_UNKNOWN;
+
+static const char *trace_path;
+static int trace_fd = -1;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+static THREAD_LOCAL struct trace_buffer trace_buffer;
+
+static void
+flush_on_thread_exit(void *arg)
+{
+	(void) arg;
+	trace_flush();
+}
+
+// opens the trace file of the process, which is the one asked for with
+// the pid appended, as processes that exec another program inherit it
+static void
+open_trace_file(void)
+{
+	char path[PATH_MAX];
+	char pid[16];
+	size_t length = strlen(trace_path);
+	size_t digits = 0;
+
+	// formatted by hand, printf may allocate
+	for (pid_t n = getpid(); n > 0; n /= 10)
+		pid[digits++] = '0' + n % 10;
+	if (length + digits + 2 > sizeof(path))
+		return;
+
+	memcpy(path, trace_path, length);
+	path[length++] = '.';
+	while (digits > 0)
+		path[length++] = pid[--digits];
+	path[length] = '\0';
+
+	trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+}
+
+// opens the trace file if tracing was asked for
+static void
+init_trace(void)
+{
+	trace_path = getenv(TRACE_FILE_ENV);
+	if (trace_path && *trace_path)
+		open_trace_file();
+	if (trace_fd < 0) {
+		__atomic_store_n(&trace_state, TRACE_OFF, __ATOMIC_RELEASE);
+		return;
+	}
+
+	pthread_key_create(&trace_key, flush_on_thread_exit);
+	__atomic_store_n(&trace_state, TRACE_ON, __ATOMIC_RELEASE);
+}
+
+void
+trace_record(enum trace_op op, void *ptr, void *old_ptr, size_t size)
+{
+	pthread_once(&trace_once, init_trace);
+	if (trace_state != TRACE_ON)
+		return;
+
+	struct trace_buffer *buffer = &trace_buffer;
+	if (!buffer->registered) {
+		// pthread_setspecific may allocate, which must not register
+		// it again
+		buffer->registered = true;
+		buffer->thread = gettid();
+		pthread_setspecific(trace_key, buffer);
+	}
+
+	// Timestamps of a thread never repeat, so sorting by them keeps
+	// its records in order
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t timestamp = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+	if (timestamp <= buffer->last_timestamp)
+		timestamp = buffer->last_timestamp + 1;
+	buffer->last_timestamp = timestamp;
+
+	struct trace_record *record = &buffer->records[buffer->count++];
+	record->op = op;
+	record->thread = buffer->thread;
+	record->timestamp = timestamp;
+	record->id = (uintptr_t) ptr;
+	record->old_id = (uintptr_t) old_ptr;
+	record->size = size;
+
+	if (buffer->count == TRACE_BUFFER_RECORDS)
+		trace_flush();
+}
+
+// writes the records of the calling thread to the trace file
+void
+trace_flush(void)
+{
+	struct trace_buffer *buffer = &trace_buffer;
+
+	if (trace_fd < 0 || buffer->count == 0)
+		return;
+
+	const char *data = (const char *) buffer->records;
+	size_t size = buffer->count * sizeof(struct trace_record);
+	while (size > 0) {
+		ssize_t written = write(trace_fd, data, size);
+		if (written <= 0)
+			break;
+		data += written;
+		size -= written;
+	}
+	buffer->count = 0;
+}
+
+// The thread that exits the process doesn't run the key destructor
+__attribute__((destructor)) static void
+flush_on_exit(void)
+{
+	trace_flush();
+}
+
+// A child gets the buffer of the thread that forked, whose records are
+// written by the parent, and has a trace file and thread id of its own
+static void
+postfork_child(void)
+{
+	trace_buffer.count = 0;
+	trace_buffer.thread = gettid();
+	if (trace_fd >= 0) {
+		close(trace_fd);
+		trace_fd = -1;
+		open_trace_file();
+		if (trace_fd < 0)
+			trace_state = TRACE_OFF;
+	}
+}
+
+__attribute__((constructor)) static void
+register_fork_handler(void)
+{
+	pthread_atfork(NULL, NULL, postfork_child);
+}
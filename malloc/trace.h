@@ -0,0 +1,42 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// When MALLOC_TRACE_FILE is set, malloc, free and realloc append a
+// record of every call to that file, with the pid of the process
+// appended to its name. Records are kept in a buffer per thread and
+// written with write(2), so tracing never allocates.
+#define TRACE_FILE_ENV "MALLOC_TRACE_FILE"
+#define TRACE_BUFFER_RECORDS 256
+
+enum trace_op { TRACE_MALLOC = 1, TRACE_FREE, TRACE_REALLOC };
+
+enum trace_state { TRACE_UNKNOWN, TRACE_ON, TRACE_OFF };
+
+// The objects of a trace are identified by their pointers, which are
+// reused once freed, so records must be replayed in timestamp order
+struct trace_record {
+	uint8_t op;
+	uint8_t unused[3];
+	uint32_t thread;
+	uint64_t timestamp;  // nanoseconds
+	uint64_t id;
+	uint64_t old_id;  // realloc only
+	uint64_t size;
+};
+
+extern enum trace_state trace_state;
+
+#define TRACE(op, ptr, old_ptr, size)                                          \
+	do {                                                                   \
+		if (trace_state != TRACE_OFF)                                  \
+			trace_record(op, ptr, old_ptr, size);                  \
+	} while (0)
+
+void trace_record(enum trace_op op, void *ptr, void *old_ptr, size_t size);
+
+void trace_flush(void);
+
+#endif  // _TRACE_H_
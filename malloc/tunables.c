@@ -0,0 +1,223 @@
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pagemap.h"
+#include "tcache.h"
+#include "tunables.h"
+
+struct tunables tunables = {
+	.strategy = DEFAULT_STRATEGY,
+	.good_fit_tolerance = GOOD_FIT_TOLERANCE,
+	.good_fit_candidates = GOOD_FIT_CANDIDATES,
+	.region_min_size = REGION_MIN_SIZE,
+	.block_sizes = { SMALL_BLOCK, MEDIUM_BLOCK, LARGE_BLOCK },
+	.tcache_depth = TCACHE_DEPTH,
+	.retained_blocks = RETAINED_BLOCKS,
+	.decay_ms = DECAY_MS,
+};
+
+static pthread_once_t tunables_once = PTHREAD_ONCE_INIT;
+
+static const char *const strategy_names[STRATEGIES] = {
+	[STRATEGY_FIRST_FIT] = "first_fit",
+	[STRATEGY_BEST_FIT] = "best_fit",
+	[STRATEGY_NEXT_FIT] = "next_fit",
+	[STRATEGY_GOOD_FIT] = "good_fit",
+};
+
+static const char *const block_keys[ARENA_KINDS] = { "small_block",
+	                                             "medium_block",
+	                                             "large_block" };
+
+// returns true if the string of the given length is the name
+static bool
+matches(const char *string, size_t length, const char *name)
+{
+	return strlen(name) == length && memcmp(string, name, length) == 0;
+}
+
+// parses a decimal number with an optional k, m or g suffix
+static bool
+parse_size(const char *value, size_t length, size_t *size)
+{
+	size_t n = 0;
+	size_t i = 0;
+
+	for (; i < length && value[i] >= '0' && value[i] <= '9'; i++) {
+		if (n > (SIZE_MAX - 9) / 10)
+			return false;
+		n = n * 10 + (value[i] - '0');
+	}
+	if (i == 0)
+		return false;
+
+	int shift = 0;
+	if (i + 1 == length) {
+		switch (value[i]) {
+		case 'k':
+		case 'K':
+			shift = 10;
+			break;
+		case 'm':
+		case 'M':
+			shift = 20;
+			break;
+		case 'g':
+		case 'G':
+			shift = 30;
+			break;
+		default:
+			return false;
+		}
+		i++;
+	}
+	if (i != length || n > (SIZE_MAX >> shift))
+		return false;
+
+	*size = n << shift;
+	return true;
+}
+
+// sets the tunable of the key to the value, returns false if the key
+// is unknown or the value is out of its range
+static bool
+parse_pair(struct tunables *parsed,
+           const char *key,
+           size_t key_length,
+           const char *value,
+           size_t length)
+{
+	size_t n;
+
+	if (matches(key, key_length, "strategy")) {
+		for (int i = 0; i < STRATEGIES; i++) {
+			if (matches(value, length, strategy_names[i])) {
+				parsed->strategy = i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	if (!parse_size(value, length, &n))
+		return false;
+
+	for (int kind = 0; kind < ARENA_KINDS; kind++) {
+		if (matches(key, key_length, block_keys[kind])) {
+			// Blocks of regions are aligned to their size
+			if (!IS_POWER_OF_2(n) || n < PAGE_SIZE || n > BLOCK_MAX_SIZE)
+				return false;
+			parsed->block_sizes[kind] = n;
+			return true;
+		}
+	}
+
+	if (matches(key, key_length, "region_min_size")) {
+		// Smaller regions would be in the size range of slabs
+		if (n < REGION_MIN_SIZE || n % ALIGNMENT != 0)
+			return false;
+		parsed->region_min_size = n;
+	} else if (matches(key, key_length, "tcache_depth")) {
+		if (n > UCHAR_MAX)  // the count of a tcache bin is a byte
+			return false;
+		parsed->tcache_depth = n;
+	} else if (matches(key, key_length, "good_fit_tolerance")) {
+		if (n > 100)  // a percent of the size
+			return false;
+		parsed->good_fit_tolerance = n;
+	} else if (matches(key, key_length, "good_fit_candidates")) {
+		if (n == 0)
+			return false;
+		parsed->good_fit_candidates = n;
+	} else if (matches(key, key_length, "retained_blocks")) {
+		parsed->retained_blocks = n;
+	} else if (matches(key, key_length, "decay_ms")) {
+		parsed->decay_ms = n;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// returns true if each arena's blocks are bigger than the ones of the
+// previous arena, and the smallest ones hold a split minimum region
+static bool
+valid_block_sizes(struct tunables *parsed)
+{
+	for (int kind = 1; kind < ARENA_KINDS; kind++) {
+		if (parsed->block_sizes[kind] <= parsed->block_sizes[kind - 1])
+			return false;
+	}
+	return 2 * (REGION_HEADER_SIZE + parsed->region_min_size) <=
+	       parsed->block_sizes[0];
+}
+
+// applies the key:value pairs of the conf to the tunables, returns
+// false if any of them is invalid. The sizes of the blocks and regions
+// are kept as they were if together they are invalid.
+bool
+parse_tunables(const char *conf, struct tunables *parsed)
+{
+	struct tunables previous = *parsed;
+	bool valid = true;
+
+	while (*conf) {
+		size_t length = strcspn(conf, ",");
+		const char *value = memchr(conf, ':', length);
+
+		if (!value || !parse_pair(parsed,
+		                          conf,
+		                          value - conf,
+		                          value + 1,
+		                          length - (value + 1 - conf)))
+			valid = false;
+
+		conf += length;
+		if (*conf == ',')
+			conf++;
+	}
+
+	if (!valid_block_sizes(parsed)) {
+		parsed->region_min_size = previous.region_min_size;
+		memcpy(parsed->block_sizes,
+		       previous.block_sizes,
+		       sizeof(parsed->block_sizes));
+		valid = false;
+	}
+	return valid;
+}
+
+// writes to stderr the conf that was ignored in part, by hand as
+// printf may allocate
+static void
+report_invalid(const char *conf)
+{
+	static const char message[] = "malloc: invalid pairs of " TUNABLES_ENV
+	                              " ignored: ";
+
+	if (write(STDERR_FILENO, message, sizeof(message) - 1) < 0 ||
+	    write(STDERR_FILENO, conf, strlen(conf)) < 0)
+		return;
+	if (write(STDERR_FILENO, "\n", 1) < 0)
+		return;
+}
+
+static void
+init_tunables(void)
+{
+	const char *conf = getenv(TUNABLES_ENV);
+
+	if (conf && !parse_tunables(conf, &tunables))
+		report_invalid(conf);
+	__atomic_store_n(&tunables.loaded, true, __ATOMIC_RELEASE);
+}
+
+// loads the tunables, once. Sizes of blocks and regions must not change
+// after the first allocation, which calls it.
+void
+load_tunables(void)
+{
+	pthread_once(&tunables_once, init_tunables);
+}
@@ -0,0 +1,65 @@
+#ifndef _TUNABLES_H_
+#define _TUNABLES_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "block.h"
+
+// The tunables start with the values the library was built with, and
+// are changed when the process starts with the MALLOC_CONF variable, a
+// list of key:value pairs separated by commas, like
+//     MALLOC_CONF=strategy:best_fit,large_block:64M,decay_ms:0
+// Sizes take an optional k, m or g suffix. Invalid pairs are ignored
+// and reported on stderr. It's read before the first allocation and
+// parsed without allocating.
+#define TUNABLES_ENV "MALLOC_CONF"
+
+enum strategy {
+	STRATEGY_FIRST_FIT,
+	STRATEGY_BEST_FIT,
+	STRATEGY_NEXT_FIT,
+	STRATEGY_GOOD_FIT,
+	STRATEGIES
+};
+
+// make USE_FF=true, USE_BF=true, USE_NF=true or USE_GF=true chooses the
+// default strategy
+#if defined(BEST_FIT)
+#define DEFAULT_STRATEGY STRATEGY_BEST_FIT
+#elif defined(NEXT_FIT)
+#define DEFAULT_STRATEGY STRATEGY_NEXT_FIT
+#elif defined(GOOD_FIT)
+#define DEFAULT_STRATEGY STRATEGY_GOOD_FIT
+#else
+#define DEFAULT_STRATEGY STRATEGY_FIRST_FIT
+#endif
+
+// Good fit takes the first region that wastes at most
+// GOOD_FIT_TOLERANCE percent of the size, or the smallest of the first
+// GOOD_FIT_CANDIDATES regions that hold it
+#define GOOD_FIT_TOLERANCE 10
+#define GOOD_FIT_CANDIDATES 4
+
+struct tunables {
+	enum strategy strategy;           // strategy (first_fit, best_fit...)
+	size_t good_fit_tolerance;        // good_fit_tolerance (percent)
+	size_t good_fit_candidates;       // good_fit_candidates
+	size_t region_min_size;           // region_min_size
+	size_t block_sizes[ARENA_KINDS];  // small_block, medium_block, large_block
+	size_t tcache_depth;              // tcache_depth
+	size_t retained_blocks;           // retained_blocks
+	uint64_t decay_ms;                // decay_ms
+	bool loaded;
+};
+
+extern struct tunables tunables;
+
+// Regions that don't fit in a large block are huge
+#define LARGE_BLOCK_SIZE (tunables.block_sizes[ARENA_KINDS - 1])
+
+void load_tunables(void);
+
+bool parse_tunables(const char *conf, struct tunables *parsed);
+
+#endif  // _TUNABLES_H_